@@ -0,0 +1,38 @@
+ /*****************************************************************************\ 
+ |         This program was written by Asher Glick aglick@tetrakai.com         | 
+ |             This program is currently under the GNU GPL licence             |
+ \*****************************************************************************/
+
+#ifndef BENCHCLOCK_H
+#define BENCHCLOCK_H
+
+/******************************** BENCH CLOCK *********************************\
+| The clocks the host benchmarks time the decoder with. Needs _POSIX_C_SOURCE |
+| 199309L defined before the first include for clock_gettime                  |
+\******************************************************************************/
+#include <time.h>
+
+/************************************ NOW *************************************\
+| Returns the time in nanoseconds                                              |
+\******************************************************************************/
+static inline double now (void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+/*********************************** CYCLES ***********************************\
+| Returns the CPU time stamp counter on x86, 0 everywhere else so the cycle    |
+| columns just read zero                                                       |
+\******************************************************************************/
+static inline unsigned long long cycles (void) {
+#if defined(__x86_64__) || defined(__i386__)
+  unsigned int low, high;
+  __asm__ __volatile__ ("rdtsc" : "=a" (low), "=d" (high));
+  return ((unsigned long long)high << 32) | low;
+#else
+  return 0;
+#endif
+}
+
+#endif
@@ -0,0 +1,221 @@
+ /*****************************************************************************\ 
+ |         This program was written by Asher Glick aglick@tetrakai.com         | 
+ |             This program is currently under the GNU GPL licence             |
+ \*****************************************************************************/
+
+/******************************* FSK GENERATOR ********************************\
+| Turns a credential into the pulse counts the INT0 interrupt would store for  |
+| a card held at the reader, spoiled as much as a struct fskSignal says, so    |
+| the decoder can be tried on conditions no recorded trace has. Used by        |
+| fskgen to write trace files and by sweep, see Doc/hostbench.md               |
+\******************************************************************************/
+
+#include "fsk.h"
+
+/*********************************** RANDOM ***********************************\
+| A xorshift generator, so the same seed gives the same counts on every PC     |
+| and C library                                                                |
+\******************************************************************************/
+unsigned long fskRandom (unsigned long * state) {
+  unsigned long x = *state & 0xFFFFFFFFUL;
+  if (x == 0) {
+    x = 0x9E3779B9UL;
+  }
+  x ^= (x << 13) & 0xFFFFFFFFUL;
+  x ^= x >> 17;
+  x ^= (x << 5) & 0xFFFFFFFFUL;
+  *state = x;
+  return x;
+}
+
+// Returns a number from 0 up to but not including 1
+static double fskUniform (unsigned long * state) {
+  return fskRandom(state) / 4294967296.0;
+}
+
+/********************************* FSK FRAME **********************************\
+| Packs a credential into a 45 bit frame the way the card sends it: bits 0-6   |
+| 0, bit 7 and the sentinel for cards shorter than 37 bits, then the card.     |
+| The bits of the card that are not the site code or unique id are its         |
+| parity bits, every setting of them is tried until frameParity agrees.        |
+| Returns 0 if the format is unknown or the fields do not fit                  |
+\******************************************************************************/
+struct fskFormat {
+  unsigned char bits;
+  unsigned char siteOffset;
+  unsigned char siteLength;
+  unsigned char uniqueOffset;
+  unsigned char uniqueLength;
+};
+
+static const struct fskFormat fskFormats[FORMAT_COUNT] = {
+  #define FORMAT(name, bits, siteOffset, siteLength, uniqueOffset, uniqueLength) \
+  {bits, siteOffset, siteLength, uniqueOffset, uniqueLength},
+  FORMATS
+  #undef FORMAT
+};
+
+static void setBit (unsigned char frame[FRAME_BYTES], int bit, int value) {
+  if (value) {
+    frame[bit >> 3] |= 0x80 >> (bit & 0x07);
+  }
+  else {
+    frame[bit >> 3] &= ~(0x80 >> (bit & 0x07));
+  }
+}
+
+static void setField (unsigned char frame[FRAME_BYTES], int offset, int length, unsigned long value) {
+  int i;
+  for (i = 0; i < length; i++) {
+    setBit(frame, offset + i, (value >> (length - 1 - i)) & 0x01);
+  }
+}
+
+char fskFrame (unsigned char format, unsigned long site, unsigned long unique, unsigned char frame[FRAME_BYTES]) {
+  const struct fskFormat * f;
+  int parityBits[FRAME_HALF_BITS / 2];
+  int parities = 0;
+  int start;
+  int bit;
+  int i;
+  unsigned long setting;
+  if (format >= FORMAT_COUNT) {
+    return 0;
+  }
+  f = &fskFormats[format];
+  if ((site >> f->siteLength) != 0 || (unique >> f->uniqueLength) != 0) {
+    return 0;
+  }
+  start = FORMAT_START(f->bits);
+  for (i = 0; i < FRAME_BYTES; i++) {
+    frame[i] = 0;
+  }
+  if (f->bits < 37) {
+    setBit(frame, 7, 1);
+    setBit(frame, start - 1, 1);
+  }
+  setField(frame, start + f->siteOffset, f->siteLength, site);
+  setField(frame, start + f->uniqueOffset, f->uniqueLength, unique);
+  for (bit = 0; bit < f->bits; bit++) {
+    if ((bit < f->siteOffset || bit >= f->siteOffset + f->siteLength) &&
+        (bit < f->uniqueOffset || bit >= f->uniqueOffset + f->uniqueLength)) {
+      parityBits[parities++] = start + bit;
+    }
+  }
+  for (setting = 0; setting < (1UL << parities); setting++) {
+    for (i = 0; i < parities; i++) {
+      setBit(frame, parityBits[i], (setting >> i) & 0x01);
+    }
+    if (frameParity(frame)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/******************************** FSK GENERATE ********************************\
+| Writes the pulse counts of signal->noise counts of carrier noise and then    |
+| signal->frames copies of frame, at most max counts. Each frame is a start    |
+| tag, three half bits of 0s and three of 1s, and the 45 bits in manchester    |
+| code, 1 as 10 and 0 as 01, with three half bits of 0s after the last one to  |
+| end it. Each half bit is FSK_ZERO_WAVES or FSK_ONE_WAVES waves long, the     |
+| part of a wave left over is carried into the next half bit. Then the waves   |
+| are spoiled:                                                                 |
+|   jitter  moves each half bit's length and each wave's count                 |
+|   edges   counts the wave at a change of value halfway between the two       |
+|   drop    takes pulses out of a wave, extra adds one                         |
+|   skew    scales every count, carrying the rounding on like a real clock     |
+|   phase   cuts waves off the start of the card                               |
+| complete is set to how many frames are whole, start tag and all. Returns     |
+| the number of counts written                                                 |
+\******************************************************************************/
+static unsigned char noiseCounts[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 12, 30};
+
+int fskGenerate (const unsigned char frame[FRAME_BYTES], const struct fskSignal * signal,
+                 unsigned char * counts, int max, int * complete) {
+  unsigned long random = signal->seed;
+  unsigned char halfBits[6 + FRAME_HALF_BITS];
+  double carry = 0.0;
+  double skewCarry = 0.0;
+  int previous = -1;
+  int length = 0;
+  int card;
+  int f;
+  int h;
+  int i;
+
+  // the half bits of one frame, with its start tag
+  for (i = 0; i < 6; i++) {
+    halfBits[i] = i >= 3;
+  }
+  for (i = 0; i < FRAME_HALF_BITS / 2; i++) {
+    halfBits[6 + i * 2] = FRAME_BIT(frame, i);
+    halfBits[7 + i * 2] = !FRAME_BIT(frame, i);
+  }
+
+  for (i = 0; i < signal->noise && length < max; i++) {
+    counts[length++] = noiseCounts[fskRandom(&random) % sizeof(noiseCounts)];
+  }
+  card = length;
+  *complete = 0;
+  for (f = 0; f <= signal->frames; f++) {
+    // after the last frame only the 0s of the next start tag are sent
+    int halves = f == signal->frames ? 3 : 6 + FRAME_HALF_BITS;
+    if (f < signal->frames && length - card + 1 > signal->phase) {
+      // only frames that phase cuts nothing off are complete
+      (*complete)++;
+    }
+    for (h = 0; h < halves; h++) {
+      int value = halfBits[h];
+      double waves = (value ? FSK_ONE_WAVES : FSK_ZERO_WAVES)
+                   * (1.0 + signal->jitter * (2.0 * fskUniform(&random) - 1.0)) + carry;
+      int whole = (int)waves;
+      carry = waves - whole;
+      if (previous != -1 && previous != value && length > card &&
+          fskUniform(&random) < signal->edges) {
+        counts[length - 1] = (WAVE_ZERO + WAVE_ONE) / 2;
+      }
+      previous = value;
+      for (i = 0; i < whole && length < max; i++) {
+        double pulses = (value ? WAVE_ONE : WAVE_ZERO)
+                      * (1.0 + signal->jitter * (2.0 * fskUniform(&random) - 1.0));
+        int count = (int)(pulses + 0.5);
+        int p;
+        for (p = count; p > 0; p--) {
+          if (fskUniform(&random) < signal->drop) {
+            count--;
+          }
+        }
+        if (fskUniform(&random) < signal->extra) {
+          count++;
+        }
+        counts[length++] = count;
+      }
+    }
+    if (length == max && f < signal->frames) {
+      // the last frame was cut short by the end of counts
+      (*complete)--;
+      break;
+    }
+  }
+
+  // the card came into the field phase waves late
+  if (signal->phase > 0) {
+    int cut = signal->phase < length - card ? signal->phase : length - card;
+    for (i = card; i + cut < length; i++) {
+      counts[i] = counts[i + cut];
+    }
+    length -= cut;
+  }
+
+  for (i = 0; i < length; i++) {
+    double want = counts[i] * (1.0 + signal->skew / 100.0) + skewCarry;
+    int count = (int)(want + 0.5);
+    if (count > 255) {
+      count = 255;
+    }
+    skewCarry = want - count;
+    counts[i] = count;
+  }
+  return length;
+}
@@ -0,0 +1,44 @@
+ /*****************************************************************************\ 
+ |         This program was written by Asher Glick aglick@tetrakai.com         | 
+ |             This program is currently under the GNU GPL licence             |
+ \*****************************************************************************/
+
+#ifndef FSK_H
+#define FSK_H
+
+#include "decode.h"
+
+/******************************* FSK SETTINGS *********************************\
+| A HID card sends each half of a manchester bit as 50 carrier cycles of FSK,  |
+| waves of 8 cycles for a 0 and 10 for a 1, so a half bit is 6.25 waves of 0s  |
+| or 5 waves of 1s. The INT0 interrupt counts WAVE_ZERO or WAVE_ONE pulses in  |
+| each wave                                                                    |
+\******************************************************************************/
+#define FSK_ZERO_WAVES 6.25 // waves in half a bit of 0s
+#define FSK_ONE_WAVES  5.0  // waves in half a bit of 1s
+
+/********************************* FSK SIGNAL *********************************\
+| How the pulse counts of a card in the field are spoiled                      |
+\******************************************************************************/
+struct fskSignal {
+  double jitter;  // each wave's pulse count and each half bit's length in
+                  // waves is off by up to this fraction
+  double edges;   // chance the wave across a change of value is counted
+                  // halfway between a 0 and a 1
+  double drop;    // chance each pulse is missed
+  double extra;   // chance each wave gets a pulse too many
+  double skew;    // percent the reader's clock is fast (+) or slow (-), every
+                  // count is scaled by it
+  int phase;      // waves of the card cut off the start, as if it came into
+                  // the field part way through a frame
+  int frames;     // frames the card sends
+  int noise;      // random counts before the card, carrier noise
+  unsigned long seed; // the same seed and settings give the same counts
+};
+
+unsigned long fskRandom (unsigned long * state);
+char fskFrame (unsigned char format, unsigned long site, unsigned long unique, unsigned char frame[FRAME_BYTES]);
+int fskGenerate (const unsigned char frame[FRAME_BYTES], const struct fskSignal * signal,
+                 unsigned char * counts, int max, int * complete);
+
+#endif
@@ -0,0 +1,106 @@
+ /*****************************************************************************\ 
+ |         This program was written by Asher Glick aglick@tetrakai.com         | 
+ |             This program is currently under the GNU GPL licence             |
+ \*****************************************************************************/
+
+/*********************************** FSK GEN **********************************\
+| Writes a synthetic trace of one card for hostbench, see Doc/hostbench.md     |
+|                                                                              |
+| usage: fskgen [-f format] [-s site] [-u unique] [-j jitter] [-e edges]       |
+|               [-p drop] [-x extra] [-k skew] [-o phase] [-n frames]          |
+|               [-z noise] [-S seed] [trace.txt]                               |
+\******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "fsk.h"
+
+#define MAX_COUNTS 100000 // most pulse counts a trace can have
+
+unsigned char counts[MAX_COUNTS];
+
+const char * formatNames[FORMAT_COUNT] = {
+  #define FORMAT(name, bits, siteOffset, siteLength, uniqueOffset, uniqueLength) #name,
+  FORMATS
+  #undef FORMAT
+};
+
+int main (int argc, char ** argv) {
+  struct fskSignal signal = {0.06, 0.3, 0.0, 0.0, 0.0, 0, 12, 200, 1};
+  unsigned char frame[FRAME_BYTES];
+  unsigned char format = FORMAT_H10301;
+  unsigned long site = 12;
+  unsigned long unique = 12345;
+  const char * name = NULL;
+  FILE * out = stdout;
+  int complete;
+  int length;
+  int arg = 1;
+  int i;
+
+  while (arg + 1 < argc && argv[arg][0] == '-') {
+    const char * value = argv[arg + 1];
+    switch (argv[arg][1]) {
+      case 'f':
+        for (format = 0; format < FORMAT_COUNT; format++) {
+          if (strcasecmp(value, formatNames[format]) == 0) {
+            break;
+          }
+        }
+        break;
+      case 's': site = strtoul(value, NULL, 0); break;
+      case 'u': unique = strtoul(value, NULL, 0); break;
+      case 'j': signal.jitter = atof(value); break;
+      case 'e': signal.edges = atof(value); break;
+      case 'p': signal.drop = atof(value); break;
+      case 'x': signal.extra = atof(value); break;
+      case 'k': signal.skew = atof(value); break;
+      case 'o': signal.phase = atoi(value); break;
+      case 'n': signal.frames = atoi(value); break;
+      case 'z': signal.noise = atoi(value); break;
+      case 'S': signal.seed = strtoul(value, NULL, 0); break;
+      default:
+        fprintf(stderr, "%s: unknown option %s\n", argv[0], argv[arg]);
+        return 2;
+    }
+    arg += 2;
+  }
+  if (arg < argc) {
+    name = argv[arg];
+  }
+
+  if (!fskFrame(format, site, unique, frame)) {
+    fprintf(stderr, "%s: the site and unique id do not fit a known format (", argv[0]);
+    for (i = 0; i < FORMAT_COUNT; i++) {
+      fprintf(stderr, "%s%s", i ? ", " : "", formatNames[i]);
+    }
+    fprintf(stderr, ")\n");
+    return 2;
+  }
+  length = fskGenerate(frame, &signal, counts, MAX_COUNTS, &complete);
+
+  if (name != NULL && (out = fopen(name, "w")) == NULL) {
+    fprintf(stderr, "%s: could not write %s\n", argv[0], name);
+    return 1;
+  }
+  fprintf(out, "# Synthetic %s card, site %lu, unique %lu, from fskgen -j %g -e %g\n",
+          formatNames[format], site, unique, signal.jitter, signal.edges);
+  fprintf(out, "# -p %g -x %g -k %g -o %d -n %d -z %d -S %lu\n", signal.drop,
+          signal.extra, signal.skew, signal.phase, signal.frames, signal.noise, signal.seed);
+  // the first 44 bits as 11 hex digits, the way printTag sends them
+  fprintf(out, "# expect ");
+  for (i = 0; i < 11; i++) {
+    fprintf(out, "%lX", getFrameField(frame, i * 4, 4));
+  }
+  fprintf(out, "\n# frames %d\n", complete);
+  for (i = 0; i < length; i++) {
+    fprintf(out, "%d%c", counts[i], i % 30 == 29 || i == length - 1 ? '\n' : ' ');
+  }
+  if (out != stdout) {
+    fclose(out);
+  }
+  return 0;
+}
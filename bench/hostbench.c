@@ -0,0 +1,480 @@
+ /*****************************************************************************\
+ |         This program was written by Asher Glick aglick@tetrakai.com         |
+ |             This program is currently under the GNU GPL licence             |
+ \*****************************************************************************/
+
+/********************************* HOST BENCH *********************************\
+| Replays recorded pulse count traces through the decode functions on a PC   |
+| and reports how fast and how well they decode. Built and run by            |
+| 'make host-bench', see Doc/hostbench.md for the trace format               |
+|                                                                             |
+| usage: hostbench [-r repeats] [-d percent] trace.txt [trace.txt ...]        |
+\*****************************************************************************/
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "benchclock.h"
+#include "decimal.h"
+#include "decode.h"
+
+#define MAX_TRACE 1000000 // most pulse counts a trace can hold
+
+unsigned char trace[MAX_TRACE]; // the pulse counts of the trace being replayed
+int traceLength;                // number of pulse counts in trace
+int traceFrames;                // '# frames' from the trace, 0 if not given
+char traceExpect[12];           // '# expect' from the trace, empty if not given
+
+/********************************* LOAD TRACE *********************************\
+| Reads a trace file: pulse counts separated by white space, and lines         |
+| starting with '#' as comments. Two comments are understood:                  |
+|   # expect 0000200C3039   the tag in the trace, as printHexadecimal shows it |
+|   # frames 12             how many complete frames are in the trace         |
+| Returns 0 if the file could not be read                                      |
+\******************************************************************************/
+int loadTrace (const char * name) {
+  FILE * file = fopen(name, "r");
+  char line[4096];
+  if (file == NULL) {
+    return 0;
+  }
+  traceLength = 0;
+  traceFrames = 0;
+  traceExpect[0] = '\0';
+  while (fgets(line, sizeof(line), file)) {
+    char * token;
+    if (line[0] == '#') {
+      sscanf(line, "# expect %11s", traceExpect);
+      sscanf(line, "# frames %d", &traceFrames);
+      continue;
+    }
+    for (token = strtok(line, " \t\r\n"); token; token = strtok(NULL, " \t\r\n")) {
+      if (traceLength < MAX_TRACE) {
+        trace[traceLength++] = atoi(token);
+      }
+    }
+  }
+  fclose(file);
+  return 1;
+}
+
+/******************************** DRIFT TRACE *********************************\
+| Scales every pulse count of the trace by 100+percent over 100, as if the    |
+| clock that counts them ran that much slow or fast. The part of a count that |
+| is lost to rounding is carried into the next one, so over many waves the    |
+| counts average out to the scaled value the way a real drifted clock does    |
+\******************************************************************************/
+void driftTrace (double percent) {
+  double scale = 1.0 + percent / 100.0;
+  double carry = 0.0;
+  int i;
+  for (i = 0; i < traceLength; i++) {
+    double want = trace[i] * scale + carry;
+    int count = (int)(want + 0.5);
+    if (count > 255) {
+      count = 255;
+    }
+    carry = want - count;
+    trace[i] = count;
+  }
+}
+
+/********************************* FRAME TO HEX *******************************\
+| Writes the first 44 bits of a decoded frame as 11 hex digits, the same      |
+| digits printTag sends                                                        |
+\******************************************************************************/
+void frameToHex (const unsigned char frame[FRAME_BYTES], char hex[12]) {
+  int i;
+  for (i = 0; i < 11; i++) {
+    int value = getFrameField(frame, i * 4, 4);
+    hex[i] = value > 9 ? 'A' + value - 10 : '0' + value;
+  }
+  hex[11] = '\0';
+}
+
+/******************************** RESULT COUNTS *******************************\
+| Tallies for one decoder over all of the replays                              |
+\******************************************************************************/
+struct results {
+  long attempts;  // buffers analized (three pass) or frames in the trace
+  long decoded;   // frames that decoded
+  long badParity; // frames that decoded but failed the parity check
+  long wrong;     // frames that decoded but do not match '# expect'
+  double stage[4];// nanoseconds spent in each stage
+  double cycles;  // time stamp counter cycles spent in all of the stages
+};
+
+void countFrame (struct results * result, const unsigned char frame[FRAME_BYTES], int checkParity) {
+  char hex[12];
+  if (checkParity && !frameParity(frame)) {
+    result->badParity++;
+    return;
+  }
+  result->decoded++;
+  if (traceExpect[0] != '\0') {
+    frameToHex(frame, hex);
+    if (strcasecmp(hex, traceExpect) != 0) {
+      result->wrong++;
+    }
+  }
+}
+
+/****************************** REPLAY THREE PASS *****************************\
+| Cuts the trace into ARRAYSIZE buffers, like the interrupt fills them, and    |
+| times each pass of the old three pass decoder on each one                    |
+\******************************************************************************/
+void replayThreePass (struct results * result) {
+  static char buffer[ARRAYSIZE];
+  int offset;
+  for (offset = 0; offset + ARRAYSIZE <= traceLength; offset += ARRAYSIZE) {
+    unsigned char halfBits[12];
+    unsigned char frame[FRAME_BYTES];
+    int startOffset;
+    int length;
+    int found;
+    double t0, t1, t2, t3, t4;
+    unsigned long long c0;
+    memcpy(buffer, trace + offset, ARRAYSIZE);
+
+    c0 = cycles();
+    t0 = now();
+    convertRawDataToBinary(buffer);
+    t1 = now();
+    startOffset = findStartTag(buffer);
+    t2 = now();
+    length = parseMultiBitToSingleBit(buffer, startOffset, halfBits);
+    t3 = now();
+    found = decodeManchester(halfBits, length, frame);
+    t4 = now();
+    result->cycles += cycles() - c0;
+
+    result->stage[0] += t1 - t0;
+    result->stage[1] += t2 - t1;
+    result->stage[2] += t3 - t2;
+    result->stage[3] += t4 - t3;
+    result->attempts++;
+    if (found) {
+      // the three pass decoder does not decode the parity bit
+      countFrame(result, frame, 0);
+    }
+  }
+}
+
+/******************************** REPLAY TABLE ********************************\
+| Cuts the trace into ARRAYSIZE buffers the same way and times the single     |
+| table driven pass of decodeBuffer on each one. Every frame in each buffer   |
+| is counted. The decoder carries on from one buffer to the next, like the     |
+| reader's does when no capture is thrown away                                 |
+\******************************************************************************/
+unsigned char tableFrames[MAX_TRACE / 500][FRAME_BYTES];
+int tableFound;
+
+void tableFrame (const unsigned char frame[FRAME_BYTES]) {
+  if (tableFound < MAX_TRACE / 500) {
+    memcpy(tableFrames[tableFound], frame, FRAME_BYTES);
+    tableFound++;
+  }
+}
+
+void replayTable (struct results * result) {
+  struct decoder reader;
+  int offset;
+  int i;
+  tableFound = 0;
+  decoderReset(&reader);
+  for (offset = 0; offset + ARRAYSIZE <= traceLength; offset += ARRAYSIZE) {
+    double t0;
+    unsigned long long c0;
+
+    c0 = cycles();
+    t0 = now();
+    decodeBuffer(&reader, (char *)trace + offset, tableFrame);
+    result->stage[0] += now() - t0;
+    result->cycles += cycles() - c0;
+  }
+  for (i = 0; i < tableFound; i++) {
+    countFrame(result, tableFrames[i], 1);
+  }
+  result->attempts += traceFrames ? traceFrames : tableFound;
+}
+
+/******************************* REPLAY STREAMING *****************************\
+| Feeds the whole trace through decodeWave one wave at a time                  |
+\******************************************************************************/
+void replayStreaming (struct results * result) {
+  static unsigned char frames[MAX_TRACE / 500][FRAME_BYTES];
+  struct decoder reader;
+  int found = 0;
+  int i;
+  double t0;
+  unsigned long long c0;
+  decoderReset(&reader);
+  // the decoded frames are saved and checked after the timing stops
+  c0 = cycles();
+  t0 = now();
+  for (i = 0; i < traceLength; i++) {
+    if (decodeWave(&reader, trace[i]) && found < MAX_TRACE / 500) {
+      memcpy(frames[found], reader.frame, FRAME_BYTES);
+      found++;
+    }
+  }
+  result->stage[0] += now() - t0;
+  result->cycles += cycles() - c0;
+  for (i = 0; i < found; i++) {
+    countFrame(result, frames[i], 1);
+  }
+  result->attempts += traceFrames ? traceFrames : found;
+}
+
+/****************************** RECURSE DECIMAL *******************************\
+| The recursive printer decimalFormat replaced, one /10 and %10 for each      |
+| digit. It writes into a buffer instead of sending so the two can be timed.  |
+| The PC divides by 10 with a multiply, so recurseSoftDecimal does the same  |
+| with the shift and subtract divide the AVR has to call instead             |
+\******************************************************************************/
+void recurseDecimal (unsigned long val, char ** out) {
+  if (val > 0 ) {
+    recurseDecimal(val/10, out);
+    *(*out)++ = '0'+val%10;
+  }
+}
+
+// a 32 bit divide one bit at a time, the way libgcc's __udivmodsi4 does it
+// on the AVR. noinline keeps it a call like it is there
+__attribute__((noinline)) unsigned int softDivide (unsigned int dividend, unsigned int divisor, unsigned int * remainder) {
+  unsigned int quotient = 0;
+  unsigned int rest = 0;
+  int bit;
+  for (bit = 31; bit >= 0; bit--) {
+    rest = (rest << 1) | ((dividend >> bit) & 0x01);
+    quotient <<= 1;
+    if (rest >= divisor) {
+      rest -= divisor;
+      quotient |= 1;
+    }
+  }
+  *remainder = rest;
+  return quotient;
+}
+
+void recurseSoftDecimal (unsigned long val, char ** out) {
+  unsigned int digit;
+  if (val > 0 ) {
+    recurseSoftDecimal(softDivide(val, 10, &digit), out);
+    *(*out)++ = '0'+digit;
+  }
+}
+
+/******************************** BENCH DECIMAL *******************************\
+| Times recurseDecimal, with the PC's divide and with the AVR's software      |
+| divide, against decimalFormat for fields at their full width, the biggest  |
+| number each can hold, and checks they all write the same digits            |
+\******************************************************************************/
+#define DECIMAL_REPEATS 1000000
+
+int benchDecimal (void) {
+  const struct {
+    const char * name;
+    unsigned long value;
+  } fields[] = {
+    {"H10301 manufacturer (20 bits)", 0xFFFFF},
+    {"H10304 site (16 bits)", 0xFFFF},
+    {"H10301 site (8 bits)", 0xFF},
+    {"32 bits", 0xFFFFFFFF},
+  };
+  volatile unsigned long input;
+  volatile char sink;
+  char recursed[DECIMAL_DIGITS];
+  char softRecursed[DECIMAL_DIGITS];
+  char formatted[DECIMAL_DIGITS];
+  int failed = 0;
+  unsigned int f;
+  long i;
+
+  printf("decimal output (%d numbers each):\n", DECIMAL_REPEATS);
+  for (f = 0; f < sizeof(fields) / sizeof(fields[0]); f++) {
+    double t0, recurseTime, softTime, formatTime;
+    unsigned long long c0, recurseCycles, softCycles, formatCycles;
+    unsigned char length = 0;
+    char * out = recursed;
+    char * softOut = softRecursed;
+
+    input = fields[f].value;
+    c0 = cycles();
+    t0 = now();
+    for (i = 0; i < DECIMAL_REPEATS; i++) {
+      out = recursed;
+      recurseDecimal(input, &out);
+      sink = recursed[0];
+    }
+    recurseTime = now() - t0;
+    recurseCycles = cycles() - c0;
+
+    c0 = cycles();
+    t0 = now();
+    for (i = 0; i < DECIMAL_REPEATS; i++) {
+      softOut = softRecursed;
+      recurseSoftDecimal(input, &softOut);
+      sink = softRecursed[0];
+    }
+    softTime = now() - t0;
+    softCycles = cycles() - c0;
+
+    c0 = cycles();
+    t0 = now();
+    for (i = 0; i < DECIMAL_REPEATS; i++) {
+      length = decimalFormat(input, formatted);
+      sink = formatted[0];
+    }
+    formatTime = now() - t0;
+    formatCycles = cycles() - c0;
+    (void)sink;
+
+    if (length != out - recursed || memcmp(recursed, formatted, length) != 0 ||
+        length != softOut - softRecursed || memcmp(softRecursed, formatted, length) != 0) {
+      failed = 1;
+    }
+    printf("  %-30s %.*s%s\n", fields[f].name, length, formatted, failed ? "  DIFFERENT" : "");
+    printf("  %30s recurseDecimal %7.2f ns %8.2f cycles   software divide %7.2f ns %8.2f cycles   decimalFormat %7.2f ns %8.2f cycles\n", "",
+           recurseTime / DECIMAL_REPEATS, (double)recurseCycles / DECIMAL_REPEATS,
+           softTime / DECIMAL_REPEATS, (double)softCycles / DECIMAL_REPEATS,
+           formatTime / DECIMAL_REPEATS, (double)formatCycles / DECIMAL_REPEATS);
+  }
+  return failed;
+}
+
+/******************************** PRINT RESULT ********************************\
+| Prints the frames/sec, success rate, per stage time and cycles per sample   |
+| of one decoder                                                               |
+\******************************************************************************/
+void printResult (const char * name, struct results * result, const char * stages[4], long samples) {
+  double total = result->stage[0] + result->stage[1] + result->stage[2] + result->stage[3];
+  int i;
+  printf("  %-10s %7ld/%-7ld decoded (%5.1f%%) %6ld bad parity %6ld wrong  %10.0f frames/sec  %7.2f ns/sample  %7.2f cycles/sample\n",
+         name, result->decoded, result->attempts,
+         result->attempts ? 100.0 * result->decoded / result->attempts : 0.0,
+         result->badParity, result->wrong,
+         total > 0 ? result->decoded / (total / 1e9) : 0.0,
+         samples ? total / samples : 0.0,
+         samples ? result->cycles / samples : 0.0);
+  for (i = 0; i < 4 && stages[i]; i++) {
+    printf("  %10s %-26s %10.1f us total %7.2f ns/sample\n", "", stages[i],
+           result->stage[i] / 1e3, samples ? result->stage[i] / samples : 0.0);
+  }
+}
+
+/****************************** PRINT CALIBRATION *****************************\
+| Prints where the decoder's thresholds ended up, in pulses and waves         |
+\******************************************************************************/
+void printCalibration (void) {
+  printf("calibration: zero %.2f one %.2f pulses, bit0 %.2f bit1 %.2f waves, %u updates\n",
+         calibration.zero / 4.0, calibration.one / 4.0,
+         calibration.single[0] / 4.0, calibration.single[1] / 4.0,
+         calibration.updates);
+}
+
+/********************************* ADD RESULT *********************************\
+| Adds the tallies of one trace to the totals over all traces                  |
+\******************************************************************************/
+void addResult (struct results * total, const struct results * result) {
+  int i;
+  for (i = 0; i < 4; i++) {
+    total->stage[i] += result->stage[i];
+  }
+  total->cycles += result->cycles;
+  total->attempts += result->attempts;
+  total->decoded += result->decoded;
+  total->badParity += result->badParity;
+  total->wrong += result->wrong;
+}
+
+int main (int argc, char ** argv) {
+  const char * threePassStages[4] = {"convertRawDataToBinary", "findStartTag", "parseMultiBitToSingleBit", "decodeManchester"};
+  const char * tableStages[4] = {"decodeBuffer", NULL, NULL, NULL};
+  const char * streamingStages[4] = {"decodeWave", NULL, NULL, NULL};
+  struct results threePass;
+  struct results table;
+  struct results streaming;
+  long bufferedSamples = 0;
+  long streamingSamples = 0;
+  int repeats = 100;
+  double drift = 0.0;
+  int failed = 0;
+  int arg = 1;
+  int r;
+
+  while (arg + 1 < argc && argv[arg][0] == '-') {
+    if (strcmp(argv[arg], "-r") == 0) {
+      repeats = atoi(argv[arg + 1]);
+    }
+    else if (strcmp(argv[arg], "-d") == 0) {
+      drift = atof(argv[arg + 1]);
+    }
+    else {
+      break;
+    }
+    arg += 2;
+  }
+  if (arg >= argc || argv[arg][0] == '-') {
+    fprintf(stderr, "usage: %s [-r repeats] [-d percent] trace.txt [trace.txt ...]\n", argv[0]);
+    return 2;
+  }
+
+  decodeInit();
+  memset(&threePass, 0, sizeof(threePass));
+  memset(&table, 0, sizeof(table));
+  memset(&streaming, 0, sizeof(streaming));
+  for (; arg < argc; arg++) {
+    struct results traceThreePass;
+    struct results traceTable;
+    struct results traceStreaming;
+    long samples;
+    if (!loadTrace(argv[arg])) {
+      fprintf(stderr, "%s: could not read trace\n", argv[arg]);
+      failed = 1;
+      continue;
+    }
+    if (drift != 0.0) {
+      driftTrace(drift);
+    }
+    memset(&traceThreePass, 0, sizeof(traceThreePass));
+    memset(&traceTable, 0, sizeof(traceTable));
+    memset(&traceStreaming, 0, sizeof(traceStreaming));
+    for (r = 0; r < repeats; r++) {
+      replayThreePass(&traceThreePass);
+      replayTable(&traceTable);
+      replayStreaming(&traceStreaming);
+    }
+    samples = (long)repeats * (traceLength / ARRAYSIZE) * ARRAYSIZE;
+    printf("%s: %d pulse counts, %d frames, expect %s\n", argv[arg], traceLength,
+           traceFrames, traceExpect[0] ? traceExpect : "(none)");
+    printResult("three pass", &traceThreePass, threePassStages, samples);
+    printResult("table", &traceTable, tableStages, samples);
+    printResult("streaming", &traceStreaming, streamingStages, (long)repeats * traceLength);
+
+    bufferedSamples += samples;
+    streamingSamples += (long)repeats * traceLength;
+    addResult(&threePass, &traceThreePass);
+    addResult(&table, &traceTable);
+    addResult(&streaming, &traceStreaming);
+  }
+
+  printf("all traces (%d repeats):\n", repeats);
+  printResult("three pass", &threePass, threePassStages, bufferedSamples);
+  printResult("table", &table, tableStages, bufferedSamples);
+  printResult("streaming", &streaming, streamingStages, streamingSamples);
+  printCalibration();
+
+  // a frame that decodes to the wrong tag is a decoder bug, fail the target
+  if (threePass.wrong || table.wrong || streaming.wrong) {
+    failed = 1;
+  }
+  if (benchDecimal()) {
+    failed = 1;
+  }
+  return failed;
+}
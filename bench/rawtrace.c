@@ -0,0 +1,176 @@
+ /*****************************************************************************\ 
+ |         This program was written by Asher Glick aglick@tetrakai.com         | 
+ |             This program is currently under the GNU GPL licence             |
+ \*****************************************************************************/
+
+/********************************** RAW TRACE *********************************\
+| Turns what a reader sent with its raw stream on, saved straight from the     |
+| serial port, back into the pulse counts of a trace that hostbench and simrun |
+| can replay. Packets with a bad CRC are skipped. Lost packets and lost waves  |
+| are marked with a comment, and any text the reader sent between packets,     |
+| its tags, is kept as comments too. See Doc/rawstream.md                      |
+|                                                                              |
+| usage: rawtrace dump.bin [trace.txt]                                         |
+\******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "decode.h"
+
+// the same as in main.c
+#define PACKET_SYNC 0xA5
+#define PACKET_RAW 0x03
+#define PACKET_RAW_GAP 0x04
+#define RAW_FIRST WAVE_ZERO
+#define RAW_ESCAPE 3
+
+#define MAX_DUMP 16000000 // most bytes a dump can have
+#define MAX_TEXT 256      // longest line of text that is kept
+
+unsigned char dump[MAX_DUMP];
+
+unsigned char crc8 (const unsigned char * data, int length) {
+  unsigned char crc = 0;
+  int i;
+  int j;
+  for (i = 0; i < length; i++) {
+    crc ^= data[i];
+    for (j = 0; j < 8; j++) {
+      crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+/********************************* RAW PACKET *********************************\
+| Unpacks the raw packet at data, length bytes are left in the dump. Returns   |
+| the length of the packet and puts the waves in counts, or returns 0 if it is |
+| not a whole raw packet with a good CRC                                       |
+\******************************************************************************/
+int rawPacket (const unsigned char * data, int length, unsigned char counts[255], int * waves) {
+  int at = 3;  // the first byte of the waves
+  int code = 0;
+  int escape = 0;
+  int pulses = 0;
+  if (length < 7 || data[0] != PACKET_SYNC ||
+      (data[1] != PACKET_RAW && data[1] != PACKET_RAW_GAP)) {
+    return 0;
+  }
+  *waves = 0;
+  while (*waves < data[2] || escape) {
+    int value;
+    if (at >= length) {
+      return 0;
+    }
+    value = (data[at] >> (6 - code * 2)) & 0x03;
+    if (escape) {
+      pulses = (pulses << 2) | value;
+      if (--escape == 0) {
+        counts[(*waves)++] = pulses;
+      }
+    }
+    else if (value == RAW_ESCAPE) {
+      escape = 4;
+      pulses = 0;
+    }
+    else {
+      counts[(*waves)++] = RAW_FIRST + value;
+    }
+    if (++code == 4) {
+      code = 0;
+      at++;
+    }
+  }
+  if (code != 0) {
+    at++;
+  }
+  // the sequence number and the CRC
+  if (at + 3 > length || crc8(data + 1, at + 1) != data[at + 2]) {
+    return 0;
+  }
+  return at + 3;
+}
+
+int main (int argc, char ** argv) {
+  FILE * in;
+  FILE * out = stdout;
+  char text[MAX_TEXT];
+  int textLength = 0;
+  unsigned char counts[255];
+  long length;
+  long at = 0;
+  long packets = 0;
+  long lost = 0;
+  long gaps = 0;
+  long total = 0;
+  long sequence = -1;
+  int column = 0;
+  int arg = 1;
+  int i;
+
+  if (arg >= argc || argc > arg + 2) {
+    fprintf(stderr, "usage: %s dump.bin [trace.txt]\n", argv[0]);
+    return 2;
+  }
+  if ((in = fopen(argv[arg], "rb")) == NULL) {
+    fprintf(stderr, "%s: could not read %s\n", argv[0], argv[arg]);
+    return 1;
+  }
+  length = fread(dump, 1, MAX_DUMP, in);
+  fclose(in);
+  if (arg + 1 < argc && (out = fopen(argv[arg + 1], "w")) == NULL) {
+    fprintf(stderr, "%s: could not write %s\n", argv[0], argv[arg + 1]);
+    return 1;
+  }
+
+  fprintf(out, "# Raw stream from %s\n", argv[arg]);
+  while (at < length) {
+    int waves;
+    int size = rawPacket(dump + at, length - at > 300 ? 300 : length - at, counts, &waves);
+    if (size == 0) {
+      // anything that is not a raw packet is text, kept as a comment
+      char c = dump[at++];
+      if (c == '\n' || textLength == MAX_TEXT - 1) {
+        text[textLength] = '\0';
+        if (textLength > 0) {
+          fprintf(out, "%s# %s\n", column ? "\n" : "", text);
+          column = 0;
+        }
+        textLength = 0;
+      }
+      else if (c != '\r') {
+        text[textLength++] = c;
+      }
+      continue;
+    }
+    {
+      long number = (dump[at + size - 3] << 8) | dump[at + size - 2];
+      long missing = sequence < 0 ? 0 : (number - sequence - 1) & 0xFFFF;
+      if (missing || dump[at + 1] == PACKET_RAW_GAP) {
+        fprintf(out, "%s# gap, %ld packets lost%s\n", column ? "\n" : "", missing,
+                dump[at + 1] == PACKET_RAW_GAP ? ", waves lost" : "");
+        column = 0;
+        lost += missing;
+        gaps++;
+      }
+      sequence = number;
+    }
+    for (i = 0; i < waves; i++) {
+      fprintf(out, "%d%c", counts[i], column == 29 ? '\n' : ' ');
+      column = column == 29 ? 0 : column + 1;
+    }
+    total += waves;
+    packets++;
+    at += size;
+  }
+  if (column) {
+    fprintf(out, "\n");
+  }
+  if (out != stdout) {
+    fclose(out);
+  }
+  fprintf(stderr, "%ld packets, %ld waves, %ld gaps, %ld packets lost\n", packets, total, gaps, lost);
+  return 0;
+}
@@ -0,0 +1,439 @@
+ /*****************************************************************************\ 
+ |         This program was written by Asher Glick aglick@tetrakai.com         | 
+ |             This program is currently under the GNU GPL licence             |
+ \*****************************************************************************/
+
+/*********************************** SIM RUN **********************************\
+| Runs the firmware ELF, unchanged, in simavr and plays a trace file into it   |
+| as the 125kHz carrier on INT0 (PD2) and DEMOD_OUT on PB0, then reports how   |
+| long the capture interrupt takes and waits, how many edges it missed, how    |
+| long the tag took to come out of the USART and how deep the stack got.       |
+| With -2 a second trace is played on PC0 for a Second_Channel build, as       |
+| DEMOD_OUT of the second antenna. Built and run by 'make sim', see            |
+| Doc/simulation.md and Doc/channels.md                                        |
+|                                                                              |
+| usage: simrun [-m mcu] [-f hz] [-c carrier] [-t ms] [-2 trace2.txt]          |
+|               firmware.out trace.txt                                         |
+\******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sim_avr.h>
+#include <sim_elf.h>
+#include <sim_irq.h>
+#include <sim_cycle_timers.h>
+#include <avr_ioport.h>
+#include <avr_uart.h>
+
+#define MAX_TRACE 1000000 // most pulse counts a trace can hold
+#define MAX_OUTPUT 4096   // serial output that is kept for the report
+#define LEAD_MS 1         // time from the capture interrupt being turned on
+                          // to the first carrier edge
+
+// ATmega328P registers and vectors, as data space addresses
+#define EIFR_ADDRESS   0x3C // INTF0 is bit 0
+#define EIMSK_ADDRESS  0x3D // INT0 is bit 0
+#define TIFR1_ADDRESS  0x36 // ICF1 is bit 5
+#define TIMSK1_ADDRESS 0x6F // ICIE1 is bit 5
+#define PCIFR_ADDRESS  0x3B // PCIF1 is bit 1
+#define PCICR_ADDRESS  0x68 // PCIE1 is bit 1
+#define INT0_VECTOR 1
+#define PCINT1_VECTOR 4
+#define TIMER1_CAPT_VECTOR 10
+
+unsigned char traces[2][MAX_TRACE]; // the pulse counts of each trace
+int traceLengths[2];                // number of pulse counts in each trace
+
+/********************************* LOAD TRACE *********************************\
+| Reads a trace in the format hostbench reads, pulse counts separated by       |
+| white space and lines starting with '#' as comments. DEMOD_OUT has to be     |
+| high and low in every wave so counts under 2 can not be played, they are     |
+| left out. Returns 0 if the file could not be read                            |
+\******************************************************************************/
+int loadTrace (const char * name, unsigned char * trace, int * traceLength) {
+  FILE * file = fopen(name, "r");
+  char line[4096];
+  if (file == NULL) {
+    return 0;
+  }
+  *traceLength = 0;
+  while (fgets(line, sizeof(line), file)) {
+    char * token;
+    if (line[0] == '#') {
+      continue;
+    }
+    for (token = strtok(line, " \t\r\n"); token; token = strtok(NULL, " \t\r\n")) {
+      int count = atoi(token);
+      if (count > 1 && *traceLength < MAX_TRACE) {
+        trace[(*traceLength)++] = count > 255 ? 255 : count;
+      }
+    }
+  }
+  fclose(file);
+  return 1;
+}
+
+/*********************************** PLAYER ***********************************\
+| Plays the trace from a cycle timer. Each carrier period is a falling edge    |
+| and then a rising edge of INT0, half a period apart. DEMOD_OUT changes on    |
+| the falling edge so it is steady when the rising edge is counted, it is      |
+| high for the first half of each wave's pulses and low for the rest, so the   |
+| interrupt sees a rising DEMOD_OUT at the start of every wave. The second     |
+| channel's player has no carrier pin, only its DEMOD_OUT on PC0, and every    |
+| change of it is an edge since the pin change interrupt runs on both          |
+\******************************************************************************/
+struct player {
+  const unsigned char * trace; // the pulse counts it plays
+  int length;              // number of them
+  avr_irq_t * carrier;     // PD2, INT0, NULL for the second channel
+  avr_irq_t * demod;       // PB0, DEMOD_OUT and ICP1, or PC0 and PCINT8
+  avr_cycle_count_t half;  // cycles in half a carrier period
+  int wave;                // index in trace of the wave being played
+  int pulse;               // pulse of that wave the next rising edge is
+  char rising;             // the next edge is the rising one
+  char capture;            // the firmware times DEMOD_OUT with input capture
+                           // instead of counting carrier edges on INT0
+  char pinChange;          // the firmware times DEMOD_OUT with a pin change
+                           // interrupt, the second channel
+  char level;              // DEMOD_OUT as it was last set
+  unsigned char flagAddress; // the interrupt flag register of the edges
+  unsigned char flagMask;    // and its bit
+  long edges;              // rising edges played, of the carrier or for input
+                           // capture of DEMOD_OUT, or changes of it
+  long missed;             // edges that came while the last one was still
+                           // waiting for its interrupt
+  avr_cycle_count_t first; // cycle of the first rising carrier edge
+  avr_cycle_count_t last;  // cycle of the last edge in edges
+  char done;               // the whole trace has been played
+};
+
+// an interrupt flag still set means the interrupt has not run since the
+// last edge, the two edges are counted as one
+void playCounted (avr_t * avr, struct player * player, avr_cycle_count_t when) {
+  if (avr->data[player->flagAddress] & player->flagMask) {
+    player->missed++;
+  }
+  player->edges++;
+  player->last = when;
+}
+
+avr_cycle_count_t playEdge (avr_t * avr, avr_cycle_count_t when, void * param) {
+  struct player * player = param;
+  if (player->wave >= player->length) {
+    player->done = 1;
+    if (player->carrier) {
+      avr_raise_irq(player->carrier, 0);
+    }
+    return 0;
+  }
+  if (player->rising) {
+    if (player->first == 0) {
+      player->first = when;
+    }
+    if (!player->capture && !player->pinChange) {
+      playCounted(avr, player, when);
+    }
+    if (player->carrier) {
+      avr_raise_irq(player->carrier, 1);
+    }
+    if (++player->pulse >= player->trace[player->wave]) {
+      player->pulse = 0;
+      player->wave++;
+    }
+  }
+  else {
+    char level = player->pulse < (player->trace[player->wave] + 1) / 2;
+    if (player->carrier) {
+      avr_raise_irq(player->carrier, 0);
+    }
+    if (player->pinChange ? level != player->level : player->capture && player->pulse == 0) {
+      playCounted(avr, player, when);
+    }
+    player->level = level;
+    avr_raise_irq(player->demod, level);
+  }
+  player->rising = !player->rising;
+  return when + player->half;
+}
+
+/*********************************** SERIAL ***********************************\
+| Keeps what the firmware sends and the cycle each line ended on               |
+\******************************************************************************/
+struct serial {
+  char text[MAX_OUTPUT];
+  int length;
+  avr_cycle_count_t firstLine; // cycle the first line after the first edge
+                               // ended, 0 until then
+  int firstLineStart;          // where that line starts in text
+  struct player * player;
+  avr_t * avr;
+};
+
+void serialByte (avr_irq_t * irq, uint32_t value, void * param) {
+  struct serial * serial = param;
+  if (serial->length < MAX_OUTPUT - 1) {
+    serial->text[serial->length++] = value;
+    serial->text[serial->length] = '\0';
+  }
+  if (value == '\n' && serial->firstLine == 0 && serial->player->first != 0) {
+    int start = serial->length - 1;
+    while (start > 0 && serial->text[start - 1] != '\n') {
+      start--;
+    }
+    // blank lines are not the tag
+    if (serial->length - start > 2) {
+      serial->firstLine = serial->avr->cycle;
+      serial->firstLineStart = start;
+    }
+  }
+}
+
+/******************************** ISR BUDGET **********************************\
+| Times the capture interrupt from its vector to the reti that sets the I bit  |
+| again, and the wait from each edge to the vector. Interrupts do not nest so  |
+| only one budget is inside at a time                                          |
+\******************************************************************************/
+struct budget {
+  avr_flashaddr_t vector;     // address of the interrupt's vector, 0 until the
+                              // interrupt is turned on
+  struct player * player;     // the edges that run it
+  long runs;
+  avr_cycle_count_t entered;  // cycle the interrupt was entered, while in it
+  char inside;
+  avr_cycle_count_t total;
+  avr_cycle_count_t longest;
+  avr_cycle_count_t shortest;
+  avr_cycle_count_t waitTotal;
+  avr_cycle_count_t waitLongest;
+};
+
+void budgetStep (avr_t * avr, struct budget * budget) {
+  if (!budget->inside && avr->pc == budget->vector && budget->vector != 0) {
+    budget->inside = 1;
+    budget->entered = avr->cycle;
+    if (budget->player->edges > 0) {
+      avr_cycle_count_t wait = avr->cycle - budget->player->last;
+      budget->waitTotal += wait;
+      if (wait > budget->waitLongest) {
+        budget->waitLongest = wait;
+      }
+    }
+  }
+  else if (budget->inside && avr->sreg[S_I]) {
+    avr_cycle_count_t length = avr->cycle - budget->entered;
+    budget->inside = 0;
+    budget->runs++;
+    budget->total += length;
+    if (length > budget->longest) {
+      budget->longest = length;
+    }
+    if (length < budget->shortest) {
+      budget->shortest = length;
+    }
+  }
+}
+
+void budgetPrint (const char * name, const char * edges, struct budget * budget) {
+  struct player * player = budget->player;
+  printf("%s: %ld runs, %llu min %.1f avg %llu max cycles, edge to vector %.1f avg %llu max cycles\n",
+         name, budget->runs, (unsigned long long)(budget->runs ? budget->shortest : 0),
+         budget->runs ? (double)budget->total / budget->runs : 0.0, (unsigned long long)budget->longest,
+         budget->runs ? (double)budget->waitTotal / budget->runs : 0.0,
+         (unsigned long long)budget->waitLongest);
+  printf("%s: %ld edges, %ld missed, worst wait and run %llu cycles, %.0f%% of a carrier period\n",
+         edges, player->edges, player->missed,
+         (unsigned long long)(budget->waitLongest + budget->longest),
+         100.0 * (budget->waitLongest + budget->longest) / (player->half * 2));
+}
+
+int main (int argc, char ** argv) {
+  const char * mcu = "atmega328p";
+  unsigned long frequency = 8000000;
+  unsigned long carrierHz = 125000;
+  unsigned long tailMs = 500;
+  const char * second = NULL;
+  elf_firmware_t firmware;
+  struct player player;
+  struct player player2;
+  struct serial serial;
+  struct budget budget;
+  struct budget budget2;
+  avr_t * avr;
+  avr_cycle_count_t ready = 0;
+  avr_cycle_count_t end = 0;
+  uint32_t flags;
+  unsigned int lowestSp = 0xFFFF;
+  int failed = 0;
+  int state;
+  int arg = 1;
+
+  while (arg + 1 < argc && argv[arg][0] == '-') {
+    if (strcmp(argv[arg], "-m") == 0) {
+      mcu = argv[arg + 1];
+    }
+    else if (strcmp(argv[arg], "-f") == 0) {
+      frequency = strtoul(argv[arg + 1], NULL, 0);
+    }
+    else if (strcmp(argv[arg], "-c") == 0) {
+      carrierHz = strtoul(argv[arg + 1], NULL, 0);
+    }
+    else if (strcmp(argv[arg], "-t") == 0) {
+      tailMs = strtoul(argv[arg + 1], NULL, 0);
+    }
+    else if (strcmp(argv[arg], "-2") == 0) {
+      second = argv[arg + 1];
+    }
+    else {
+      break;
+    }
+    arg += 2;
+  }
+  if (arg + 2 != argc) {
+    fprintf(stderr, "usage: %s [-m mcu] [-f hz] [-c carrier] [-t ms] [-2 trace2.txt] firmware.out trace.txt\n", argv[0]);
+    return 2;
+  }
+  if (!loadTrace(argv[arg + 1], traces[0], &traceLengths[0])) {
+    fprintf(stderr, "%s: could not read trace\n", argv[arg + 1]);
+    return 2;
+  }
+  if (second != NULL && !loadTrace(second, traces[1], &traceLengths[1])) {
+    fprintf(stderr, "%s: could not read trace\n", second);
+    return 2;
+  }
+
+  memset(&firmware, 0, sizeof(firmware));
+  if (elf_read_firmware(argv[arg], &firmware) != 0) {
+    fprintf(stderr, "%s: could not read firmware\n", argv[arg]);
+    return 2;
+  }
+  avr = avr_make_mcu_by_name(mcu);
+  if (avr == NULL) {
+    fprintf(stderr, "simavr does not know %s\n", mcu);
+    return 2;
+  }
+  avr_init(avr);
+  avr_load_firmware(avr, &firmware);
+  avr->frequency = frequency;
+
+  memset(&player, 0, sizeof(player));
+  player.trace = traces[0];
+  player.length = traceLengths[0];
+  player.carrier = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('D'), 2);
+  player.demod = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), 0);
+  player.half = frequency / carrierHz / 2;
+  player.rising = 0;
+
+  memset(&player2, 0, sizeof(player2));
+  player2.trace = traces[1];
+  player2.length = traceLengths[1];
+  player2.demod = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('C'), 0);
+  player2.half = player.half;
+  player2.pinChange = 1;
+  player2.flagAddress = PCIFR_ADDRESS;
+  player2.flagMask = 0x02;
+
+  // keep the USART output instead of printing it as it comes
+  memset(&serial, 0, sizeof(serial));
+  serial.player = &player;
+  serial.avr = avr;
+  avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS('0'), &flags);
+  flags &= ~AVR_UART_FLAG_STDIO;
+  avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS('0'), &flags);
+  avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUTPUT), serialByte, &serial);
+
+  memset(&budget, 0, sizeof(budget));
+  budget.shortest = ~(avr_cycle_count_t)0;
+  budget.player = &player;
+  memset(&budget2, 0, sizeof(budget2));
+  budget2.shortest = ~(avr_cycle_count_t)0;
+  budget2.player = &player2;
+
+  do {
+    unsigned int sp;
+    state = avr_run(avr);
+
+    // the trace starts once main has turned on the capture interrupt
+    if (ready == 0) {
+      if (avr->data[EIMSK_ADDRESS] & 0x01) {
+        budget.vector = INT0_VECTOR * avr->vector_size;
+        player.flagAddress = EIFR_ADDRESS;
+        player.flagMask = 0x01;
+      }
+      else if (avr->data[TIMSK1_ADDRESS] & 0x20) {
+        budget.vector = TIMER1_CAPT_VECTOR * avr->vector_size;
+        player.capture = 1;
+        player.flagAddress = TIFR1_ADDRESS;
+        player.flagMask = 0x20;
+      }
+      if (budget.vector != 0) {
+        ready = avr->cycle;
+        avr_cycle_timer_register(avr, frequency / 1000 * LEAD_MS, playEdge, &player);
+      }
+    }
+    // both traces start together, so the two channels' edges often come at
+    // once, the worst case for the interrupts
+    if (second != NULL && ready != 0 && budget2.vector == 0 && avr->data[PCICR_ADDRESS] & 0x02) {
+      budget2.vector = PCINT1_VECTOR * avr->vector_size;
+      avr_cycle_timer_register(avr, ready + frequency / 1000 * LEAD_MS - avr->cycle, playEdge, &player2);
+    }
+
+    budgetStep(avr, &budget);
+    budgetStep(avr, &budget2);
+
+    sp = avr->data[R_SPL] | (avr->data[R_SPH] << 8);
+    if (sp < lowestSp) {
+      lowestSp = sp;
+    }
+
+    if (player.done && (second == NULL || player2.done || budget2.vector == 0) && end == 0) {
+      end = avr->cycle + frequency / 1000 * tailMs;
+    }
+  } while (state != cpu_Done && state != cpu_Crashed && (end == 0 || avr->cycle < end));
+
+  printf("%s in simavr as %s at %lu Hz, %s: %d waves\n", argv[arg], mcu, frequency,
+         argv[arg + 1], traceLengths[0]);
+  if (second != NULL) {
+    printf("second channel, %s: %d waves\n", second, traceLengths[1]);
+  }
+  if (state == cpu_Crashed) {
+    printf("the firmware crashed at pc 0x%04X\n", (unsigned int)avr->pc);
+    failed = 1;
+  }
+  if (ready == 0) {
+    printf("the capture interrupt was never turned on\n");
+    return 1;
+  }
+  printf("reset to ready: %llu cycles, %.2f ms\n", (unsigned long long)ready,
+         ready * 1000.0 / frequency);
+  budgetPrint(player.capture ? "ISR(TIMER1_CAPT_vect)" : "ISR(INT0_vect)",
+              player.capture ? "DEMOD_OUT" : "carrier", &budget);
+  if (second != NULL) {
+    if (budget2.vector == 0) {
+      printf("the second channel's pin change interrupt was never turned on\n");
+      failed = 1;
+    }
+    else {
+      budgetPrint("ISR(PCINT1_vect)", "DEMOD_OUT2", &budget2);
+    }
+  }
+  if (serial.firstLine) {
+    int i;
+    printf("first edge to first line: %.2f ms \"", (serial.firstLine - player.first) * 1000.0 / frequency);
+    for (i = serial.firstLineStart; serial.text[i] != '\r' && serial.text[i] != '\n'; i++) {
+      putchar(serial.text[i]);
+    }
+    printf("\"\n");
+  }
+  else {
+    printf("first edge to first line: nothing was sent\n");
+    failed = 1;
+  }
+  printf("stack: lowest SP 0x%04X, %u bytes below RAMEND\n", lowestSp,
+         (unsigned int)(avr->ramend - lowestSp));
+  if (player.missed > 0 || player2.missed > 0) {
+    failed = 1;
+  }
+  return failed;
+}
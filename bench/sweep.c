@@ -0,0 +1,254 @@
+ /*****************************************************************************\ 
+ |         This program was written by Asher Glick aglick@tetrakai.com         | 
+ |             This program is currently under the GNU GPL licence             |
+ \*****************************************************************************/
+
+/************************************ SWEEP ***********************************\
+| Reads synthetic cards through decodeWave and voteFrame while one of the      |
+| ways a signal is spoiled is turned up at a time, and reports how many        |
+| frames and cards were read, how many were read wrong and what each decoded   |
+| frame cost. The cards come from a fixed seed so two builds of the decoder    |
+| are measured on the same workload. Built and run by 'make bench-sweep', see  |
+| Doc/hostbench.md                                                             |
+|                                                                              |
+| usage: sweep [-c cards] [-S seed]                                            |
+\******************************************************************************/
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "benchclock.h"
+#include "fsk.h"
+
+#define MAX_COUNTS 20000   // pulse counts of one card
+#define MAX_FRAMES 100     // frames decoded from one card
+#define FRAME_WAVES 540    // about how many waves one frame is
+
+unsigned char counts[MAX_COUNTS];
+unsigned char frames[MAX_FRAMES][FRAME_BYTES];
+
+// the lengths of the fields of each format, to make up cards that fit
+const struct {
+  unsigned char site;
+  unsigned char unique;
+} fieldLengths[FORMAT_COUNT] = {
+  #define FORMAT(name, bits, siteOffset, siteLength, uniqueOffset, uniqueLength) \
+  {siteLength, uniqueLength},
+  FORMATS
+  #undef FORMAT
+};
+
+/********************************** SETTINGS **********************************\
+| The signal every point starts from, and the points of each setting that is   |
+| swept. Only the swept setting is moved away from the baseline. least is the  |
+| share of cards each point has to read or the sweep fails, a little under     |
+| what the decoder reads with CALIBRATE turned off, so a change that reads     |
+| worse than fixed thresholds anywhere is caught. The bars are the least each  |
+| point read over seeds 1 to 4 with CALIBRATE off, less about 0.05. A bar of 0 |
+| is a point the fixed thresholds read nothing at                              |
+\******************************************************************************/
+#define BASE_JITTER 0.06
+#define BASE_EDGES  0.3
+#define BASE_FRAMES 12
+#define BASE_NOISE  200
+
+#define AXIS_JITTER 0
+#define AXIS_EDGES  1
+#define AXIS_DROP   2
+#define AXIS_EXTRA  3
+#define AXIS_SKEW   4
+#define AXIS_PHASE  5
+#define AXES 6
+
+const struct {
+  const char * name;
+  int points;
+  double point[8];
+  double least[8];
+} axes[AXES] = {
+  {"jitter", 6, {0.0, 0.05, 0.10, 0.15, 0.20, 0.25}, {0.95, 0.95, 0.90, 0.10, 0.0, 0.0}},
+  {"edges",  5, {0.0, 0.25, 0.5, 0.75, 1.0},         {0.95, 0.95, 0.95, 0.95, 0.95}},
+  {"drop",   6, {0.0, 0.005, 0.01, 0.02, 0.05, 0.10}, {0.95, 0.95, 0.95, 0.70, 0.0, 0.0}},
+  {"extra",  6, {0.0, 0.02, 0.05, 0.1, 0.2, 0.3},    {0.95, 0.95, 0.95, 0.95, 0.95, 0.95}},
+  {"skew",   7, {-10, -5, -2, 0, 2, 5, 10},          {0.0, 0.55, 0.95, 0.95, 0.95, 0.95, 0.95}},
+  {"phase",  5, {0, 100, 250, 400, 530},             {0.95, 0.95, 0.95, 0.95, 0.95}},
+};
+
+/********************************** RESULTS ***********************************\
+| Tallies for one point of a sweep                                             |
+\******************************************************************************/
+struct results {
+  long frames;      // complete frames the cards sent
+  long decoded;     // frames that decoded with good parity
+  long wrong;       // frames with good parity that were not the card
+  long cards;       // cards held to the reader
+  long read;        // cards voteFrame reported
+  long falseAccept; // cards voteFrame reported as the wrong tag
+  long waves;       // pulse counts given to decodeWave
+  double time;      // nanoseconds spent in decodeWave
+  double cycles;    // time stamp counter cycles spent in decodeWave
+};
+
+/********************************* READ CARD **********************************\
+| Makes up a card of a random format, site and unique id, generates its pulse  |
+| counts with signal and reads them the way the reader does. Only the          |
+| decodeWave loop is timed, the parity checks and votes are done after         |
+\******************************************************************************/
+void readCard (struct fskSignal * signal, unsigned long * random, struct results * result) {
+  unsigned char card[FRAME_BYTES];
+  unsigned char format;
+  unsigned long site;
+  unsigned long unique;
+  struct decoder reader;
+  struct vote vote;
+  int complete;
+  int length;
+  int found = 0;
+  int reported = 0;
+  int i;
+  double t0;
+  unsigned long long c0;
+
+  do {
+    format = fskRandom(random) % FORMAT_COUNT;
+    site = fskRandom(random) & ((1UL << fieldLengths[format].site) - 1);
+    unique = fskRandom(random) & ((1UL << fieldLengths[format].unique) - 1);
+  } while (!fskFrame(format, site, unique, card));
+  signal->seed = fskRandom(random);
+  length = fskGenerate(card, signal, counts, MAX_COUNTS, &complete);
+
+  decoderReset(&reader);
+  c0 = cycles();
+  t0 = now();
+  for (i = 0; i < length; i++) {
+    if (decodeWave(&reader, counts[i]) && found < MAX_FRAMES) {
+      memcpy(frames[found], reader.frame, FRAME_BYTES);
+      found++;
+    }
+  }
+  result->time += now() - t0;
+  result->cycles += cycles() - c0;
+  result->waves += length;
+
+  voteReset(&vote);
+  for (i = 0; i < found; i++) {
+    if (!frameParity(frames[i])) {
+      continue;
+    }
+    result->decoded++;
+    if (memcmp(frames[i], card, FRAME_BYTES) != 0) {
+      result->wrong++;
+    }
+  }
+  for (i = 0; i < found && !reported; i++) {
+    if (voteFrame(&vote, frames[i])) {
+      reported = 1;
+      result->read++;
+      if (memcmp(vote.frame, card, FRAME_BYTES) != 0) {
+        result->falseAccept++;
+      }
+    }
+  }
+  result->frames += complete;
+  result->cards++;
+}
+
+/********************************* SWEEP AXIS *********************************\
+| Reads cards at each point of one axis and prints a line for each point.      |
+| Returns the number of points that read fewer cards than least                |
+| The decoder starts each point calibrated the way decodeInit leaves it and    |
+| keeps its calibration from card to card like the reader does                 |
+\******************************************************************************/
+int sweepAxis (int axis, int cards, unsigned long seed, struct results * total) {
+  int failed = 0;
+  int p;
+  printf("%-7s %17s %7s %14s %7s %9s %9s %9s\n", axes[axis].name, "frames decoded",
+         "wrong", "cards read", "false", "ns/wave", "ns/frame", "cyc/frame");
+  for (p = 0; p < axes[axis].points; p++) {
+    struct fskSignal signal = {BASE_JITTER, BASE_EDGES, 0.0, 0.0, 0.0, 0, BASE_FRAMES, BASE_NOISE, 0};
+    double value = axes[axis].point[p];
+    unsigned long random = seed;
+    struct results result;
+    int c;
+    switch (axis) {
+      case AXIS_JITTER: signal.jitter = value; break;
+      case AXIS_EDGES:  signal.edges = value; break;
+      case AXIS_DROP:   signal.drop = value; break;
+      case AXIS_EXTRA:  signal.extra = value; break;
+      case AXIS_SKEW:   signal.skew = value; break;
+      case AXIS_PHASE:  signal.phase = value; break;
+    }
+    memset(&result, 0, sizeof(result));
+    decodeInit();
+    for (c = 0; c < cards; c++) {
+      readCard(&signal, &random, &result);
+    }
+    printf("%7g %8ld/%-8ld %7ld %6ld/%-6ld %7ld %9.2f %9.0f %9.0f", value,
+           result.decoded, result.frames, result.wrong, result.read, result.cards,
+           result.falseAccept, result.time / result.waves,
+           result.decoded ? result.time / result.decoded : 0.0,
+           result.decoded ? result.cycles / result.decoded : 0.0);
+    if (result.read < axes[axis].least[p] * result.cards || result.falseAccept) {
+      printf("  FAIL");
+      failed++;
+    }
+    printf("\n");
+
+    total->frames += result.frames;
+    total->decoded += result.decoded;
+    total->wrong += result.wrong;
+    total->cards += result.cards;
+    total->read += result.read;
+    total->falseAccept += result.falseAccept;
+    total->waves += result.waves;
+    total->time += result.time;
+    total->cycles += result.cycles;
+  }
+  return failed;
+}
+
+int main (int argc, char ** argv) {
+  struct results total;
+  unsigned long seed = 1;
+  int cards = 200;
+  int arg = 1;
+  int failed = 0;
+  int axis;
+
+  while (arg + 1 < argc && argv[arg][0] == '-') {
+    if (strcmp(argv[arg], "-c") == 0) {
+      cards = atoi(argv[arg + 1]);
+    }
+    else if (strcmp(argv[arg], "-S") == 0) {
+      seed = strtoul(argv[arg + 1], NULL, 0);
+    }
+    else {
+      break;
+    }
+    arg += 2;
+  }
+  if (arg < argc || cards <= 0) {
+    fprintf(stderr, "usage: %s [-c cards] [-S seed]\n", argv[0]);
+    return 2;
+  }
+
+  printf("%d cards a point, seed %lu, baseline jitter %g edges %g, %d frames a card\n",
+         cards, seed, BASE_JITTER, BASE_EDGES, BASE_FRAMES);
+  memset(&total, 0, sizeof(total));
+  for (axis = 0; axis < AXES; axis++) {
+    failed += sweepAxis(axis, cards, seed, &total);
+  }
+  printf("all points: %.1f%% of frames decoded, %ld wrong, %.1f%% of cards read, %ld false accepts, %.0f ns %.0f cycles a frame\n",
+         total.frames ? 100.0 * total.decoded / total.frames : 0.0, total.wrong,
+         total.cards ? 100.0 * total.read / total.cards : 0.0, total.falseAccept,
+         total.decoded ? total.time / total.decoded : 0.0,
+         total.decoded ? total.cycles / total.decoded : 0.0);
+  if (failed) {
+    printf("%d points read too few cards or a wrong one\n", failed);
+    return 1;
+  }
+  return 0;
+}
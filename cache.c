@@ -0,0 +1,107 @@
+ /*****************************************************************************\ 
+ |         This program was written by Asher Glick aglick@tetrakai.com         | 
+ |             This program is currently under the GNU GPL licence             |
+ \*****************************************************************************/
+
+/********************************* TAG CACHE *********************************\
+| Remembers the tags that are at the reader so a card that is held there is   |
+| reported, and checked against the whitelist, once instead of on every       |
+| frame. Each entry is a whole packed frame, the channel that read it and the |
+| millisecond tick it was last read at. A tag at two antennas is two entries. |
+| Once a tag has not been read for CACHE_HOLD_MS it is removed                |
+\*****************************************************************************/
+
+#include "cache.h"
+#include "sched.h"
+
+struct cacheEntry {
+  unsigned char frame[FRAME_BYTES]; // the tag
+  unsigned int lastSeen;            // schedNow() when it was last read
+  unsigned char channel;            // the antenna it is at
+  unsigned char used;               // the entry holds a tag
+};
+struct cacheEntry cache[CACHE_SIZE];
+
+unsigned long cacheHits;
+unsigned long cacheMisses;
+
+static char sameFrame (const unsigned char a[FRAME_BYTES], const unsigned char b[FRAME_BYTES]) {
+  unsigned char i;
+  for (i = 0; i < FRAME_BYTES; i++) {
+    if (a[i] != b[i]) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/********************************* CACHE SEEN *********************************\
+| Called every time a tag is read. If the tag is already present its time is  |
+| updated and 0 is returned. If not it is added and 1 is returned, the tag    |
+| has just arrived. When the cache is full the tag that was read longest ago  |
+| is forgotten without a removed event, it will be reported again if it is    |
+| read again                                                                   |
+\******************************************************************************/
+char cacheSeen (unsigned char channel, const unsigned char frame[FRAME_BYTES]) {
+  unsigned int now = schedNow();
+  unsigned char oldest = 0;
+  unsigned char i;
+  for (i = 0; i < CACHE_SIZE; i++) {
+    if (cache[i].used && cache[i].channel == channel && sameFrame(cache[i].frame, frame)) {
+      cache[i].lastSeen = now;
+      cacheHits++;
+      return 0;
+    }
+  }
+  for (i = 0; i < CACHE_SIZE; i++) {
+    if (!cache[i].used) {
+      oldest = i;
+      break;
+    }
+    if ((unsigned int)(now - cache[i].lastSeen) > (unsigned int)(now - cache[oldest].lastSeen)) {
+      oldest = i;
+    }
+  }
+  for (i = 0; i < FRAME_BYTES; i++) {
+    cache[oldest].frame[i] = frame[i];
+  }
+  cache[oldest].lastSeen = now;
+  cache[oldest].channel = channel;
+  cache[oldest].used = 1;
+  cacheMisses++;
+  return 1;
+}
+
+/********************************* CACHE COUNT ********************************\
+| Returns how many tags are at the reader, that have not been removed yet     |
+\******************************************************************************/
+unsigned char cacheCount (void) {
+  unsigned char used = 0;
+  unsigned char i;
+  for (i = 0; i < CACHE_SIZE; i++) {
+    used += cache[i].used;
+  }
+  return used;
+}
+
+/******************************** CACHE REMOVED *******************************\
+| Looks for a tag that has not been read for CACHE_HOLD_MS. If there is one it |
+| is taken out of the cache, copied into frame with its channel and 1 is     |
+| returned. Call it until it returns 0 to get every tag that has been removed |
+\******************************************************************************/
+char cacheRemoved (unsigned char frame[FRAME_BYTES], unsigned char * channel) {
+  unsigned int now = schedNow();
+  unsigned char i;
+  unsigned char j;
+  for (i = 0; i < CACHE_SIZE; i++) {
+    if (cache[i].used && (unsigned int)(now - cache[i].lastSeen) >= CACHE_HOLD_MS) {
+      cache[i].used = 0;
+      *channel = cache[i].channel;
+      for (j = 0; j < FRAME_BYTES; j++) {
+        frame[j] = cache[i].frame[j];
+      }
+      return 1;
+    }
+  }
+  return 0;
+}
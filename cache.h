@@ -0,0 +1,25 @@
+ /*****************************************************************************\ 
+ |         This program was written by Asher Glick aglick@tetrakai.com         | 
+ |             This program is currently under the GNU GPL licence             |
+ \*****************************************************************************/
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "decode.h"
+
+/******************************* CACHE SETTINGS *******************************\
+| How many tags can be at the reader at once and how long a tag has to be     |
+| gone before it counts as removed                                             |
+\******************************************************************************/
+#define CACHE_SIZE 4        // tags remembered at once
+#define CACHE_HOLD_MS 1000  // a tag not seen for this long has been removed
+
+extern unsigned long cacheHits;   // reads of a tag that was already present
+extern unsigned long cacheMisses; // reads of a tag that was not present
+
+char cacheSeen (unsigned char channel, const unsigned char frame[FRAME_BYTES]);
+char cacheRemoved (unsigned char frame[FRAME_BYTES], unsigned char * channel);
+unsigned char cacheCount (void);
+
+#endif
@@ -0,0 +1,48 @@
+ /*****************************************************************************\ 
+ |         This program was written by Asher Glick aglick@tetrakai.com         | 
+ |             This program is currently under the GNU GPL licence             |
+ \*****************************************************************************/
+
+/******************************** DECIMAL FORMAT ******************************\
+| Writes a number in decimal without dividing. The AVR has no divide          |
+| instruction, so every /10 and %10 of an unsigned long is a call to a        |
+| software divide of a few hundred cycles. Instead each power of ten, from a  |
+| table in flash, is subtracted for as long as it fits and the number of      |
+| times it fit is the digit. That is at most 9 subtractions a digit and no    |
+| recursion. It only uses the hardware through hal.h so it can be benchmarked |
+| with 'make host-bench'                                                       |
+\*****************************************************************************/
+
+#include "hal.h"
+#include "decimal.h"
+
+const unsigned long decimalPowers[DECIMAL_DIGITS - 1] PROGMEM = {
+  1000000000, 100000000, 10000000, 1000000, 100000, 10000, 1000, 100, 10
+};
+
+/******************************** DECIMAL FORMAT ******************************\
+| Writes value into buffer as decimal digits with no leading zeros, 0 is     |
+| written as "0". The buffer is not ended with a '\0', the number of digits  |
+| is returned                                                                  |
+\******************************************************************************/
+unsigned char decimalFormat (unsigned long value, char buffer[DECIMAL_DIGITS]) {
+  unsigned char length = 0;
+  unsigned char i = 0;
+  unsigned long power;
+  char digit;
+  // skip the powers of ten that are bigger than the number
+  while (i < DECIMAL_DIGITS - 1 && value < pgm_read_dword(&decimalPowers[i])) {
+    i++;
+  }
+  for (; i < DECIMAL_DIGITS - 1; i++) {
+    power = pgm_read_dword(&decimalPowers[i]);
+    digit = '0';
+    while (value >= power) {
+      value -= power;
+      digit++;
+    }
+    buffer[length++] = digit;
+  }
+  buffer[length++] = '0' + value;
+  return length;
+}
@@ -0,0 +1,13 @@
+ /*****************************************************************************\ 
+ |         This program was written by Asher Glick aglick@tetrakai.com         | 
+ |             This program is currently under the GNU GPL licence             |
+ \*****************************************************************************/
+
+#ifndef DECIMAL_H
+#define DECIMAL_H
+
+#define DECIMAL_DIGITS 10 // digits in the biggest unsigned long, 4294967295
+
+unsigned char decimalFormat (unsigned long value, char buffer[DECIMAL_DIGITS]);
+
+#endif
@@ -0,0 +1,725 @@
+ /*****************************************************************************\ 
+ |         This program was written by Asher Glick aglick@tetrakai.com         | 
+ |             This program is currently under the GNU GPL licence             |
+ \*****************************************************************************/
+
+/********************************** DECODE ***********************************\
+| The decode functions turn the pulse counts collected by the interrupt into  |
+| the 45 bit id tag. They do not use any hardware except through hal.h so    |
+| they can also be built and benchmarked on a PC with 'make host-bench'      |
+\*****************************************************************************/
+
+#include "hal.h"
+#include "decode.h"
+#include "stats.h"
+
+/******************************* DECODE TABLES ********************************\
+| The decoder looks up what to do instead of comparing against each threshold |
+| waveValue turns the value of the last wave and the pulses in a wave into     |
+| the value of the wave:                                                       |
+|   near the 0 centre -> 0, near the 1 centre -> 1, less than 3/8 of a pulse   |
+|   from halfway between -> the last value, anything else -> unknown           |
+| The last value is looked up rather than compared, so the wave in the middle  |
+| of a group, which is most of them, takes no branch to find its value         |
+| runAction says what a group of waves with the same value means when the     |
+| value changes, by the value and how many waves were in the group. For a     |
+| bit of 'single' waves:                                                       |
+|   single/2 up to single*3/2 -> one manchester bit                            |
+|   up to single*5/2 -> two manchester bits                                    |
+|   runTagMin or more 1s -> start tag, runTagMin 0s is the end tag            |
+| decodeTables() builds them from the centres in calibration                  |
+\******************************************************************************/
+unsigned char waveValue[3][WAVE_VALUES];      // wave value for each last value
+                                              // and pulse count
+unsigned char runAction[3][RUN_LENGTHS];      // action for each value and group
+unsigned char runTagMin[3];                   // group length that is a tag
+struct calibration calibration;
+
+static unsigned char distance (unsigned char a, unsigned char b) {
+  return a > b ? a - b : b - a;
+}
+
+static void decodeTables (void) {
+  unsigned char gap = calibration.one - calibration.zero;
+  unsigned char i;
+  unsigned char v;
+  for (i = 0; i < WAVE_VALUES - 1; i++) {
+    unsigned char toZero = distance(i * 4, calibration.zero);
+    unsigned char toOne = distance(i * 4, calibration.one);
+    unsigned char value = WAVE_UNKNOWN;
+    // toZero and toOne differ by twice the distance from halfway. A wider
+    // band takes the waves of a slow clock for repeats once the centres move
+    if (distance(toZero, toOne) < 3) {
+      value = WAVE_REPEAT;
+    }
+    else if (toZero < toOne) {
+      if (toZero < gap) {
+        value = 0;
+      }
+    }
+    else if (toOne < gap) {
+      value = 1;
+    }
+    for (v = 0; v < 3; v++) {
+      waveValue[v][i] = value == WAVE_REPEAT ? v : value;
+    }
+  }
+  for (v = 0; v < 3; v++) {
+    // the last entry is every count too big for the table
+    waveValue[v][WAVE_VALUES - 1] = WAVE_UNKNOWN;
+  }
+
+  for (v = 0; v < 2; v++) {
+    unsigned char single = calibration.single[v];
+    for (i = 0; i < RUN_LENGTHS; i++) {
+      unsigned char action = RUN_NONE;
+      // i * 8 against single, which is in quarters, is i against single / 2
+      if (i * 8 >= single && i * 8 < 3 * single) {
+        action = RUN_ONE;
+      }
+      else if (i * 8 >= 3 * single && i * 8 < 5 * single) {
+        action = RUN_TWO;
+      }
+      runAction[v][i] = action;
+    }
+    runTagMin[v] = (5 * single + 7) / 8;
+  }
+  runAction[1][runTagMin[1]] = RUN_START;
+  for (i = 0; i < RUN_LENGTHS; i++) {
+    // a group of unknown values long enough to be a bit ruins the frame
+    runAction[WAVE_UNKNOWN][i] = runAction[0][i] == RUN_NONE && runAction[1][i] == RUN_NONE ? RUN_NONE : RUN_BAD;
+  }
+  runTagMin[WAVE_UNKNOWN] = RUN_LENGTHS - 1;
+}
+
+void decodeInit (void) {
+  calibration.zero = WAVE_ZERO * 4;
+  calibration.one = WAVE_ONE * 4;
+  calibration.single[0] = RUN_SINGLE * 4;
+  calibration.single[1] = RUN_SINGLE * 4;
+  calibration.updates = 0;
+  #ifdef CALIBRATE
+  {
+    unsigned char i;
+    calibration.frames = 0;
+    for (i = 0; i < WAVE_VALUES; i++) {
+      calibration.waves[i] = 0;
+    }
+    for (i = 0; i < RUN_LENGTHS; i++) {
+      calibration.runs[0][i] = 0;
+      calibration.runs[1][i] = 0;
+    }
+  }
+  #endif
+  decodeTables();
+}
+
+#ifdef CALIBRATE
+/********************************* CALIBRATE **********************************\
+| While a frame is being read the pulse count of every wave and the length of  |
+| every group of waves is counted. After CALIBRATE_FRAMES frames the centres   |
+| are moved to the average of what was read near them:                        |
+|   each pulse count goes to the wave centre it is nearest, if it is less than |
+|   the distance between the centres from it                                  |
+|   each group that is one bit counts as is, a group that is two bits counts   |
+|   as two groups of half its length, tags and shorter groups are left out   |
+| Neither centre can move more than CALIBRATE_WAVE_MOVE from where decode.h    |
+| puts it, or CALIBRATE_RUN_MOVE for the groups. Pulse counts halfway between  |
+| the centres are left out, so a centre that moves away from halfway counts    |
+| more of its far tail than its near one and would keep on moving. The         |
+| counts are then halved so older frames count for less, and the tables are    |
+| built again                                                                  |
+\******************************************************************************/
+static void calibrateHalve (void) {
+  unsigned char i;
+  for (i = 0; i < WAVE_VALUES; i++) {
+    calibration.waves[i] >>= 1;
+  }
+  for (i = 0; i < RUN_LENGTHS; i++) {
+    calibration.runs[0][i] >>= 1;
+    calibration.runs[1][i] >>= 1;
+  }
+}
+
+static unsigned char calibrateLimit (unsigned char centre, unsigned char start, unsigned char move) {
+  if (centre < start - move) {
+    return start - move;
+  }
+  if (centre > start + move) {
+    return start + move;
+  }
+  return centre;
+}
+
+static void calibrate (void) {
+  unsigned char gap = calibration.one - calibration.zero;
+  unsigned long sum[2] = {0, 0};
+  unsigned long count[2] = {0, 0};
+  unsigned char i;
+  unsigned char v;
+  for (i = 1; i < WAVE_VALUES - 1; i++) {
+    unsigned char toZero = distance(i * 4, calibration.zero);
+    unsigned char toOne = distance(i * 4, calibration.one);
+    if (toZero < toOne && toZero < gap) {
+      v = 0;
+    }
+    else if (toOne < toZero && toOne < gap) {
+      v = 1;
+    }
+    else {
+      continue;
+    }
+    sum[v] += (unsigned long)calibration.waves[i] * i * 4;
+    count[v] += calibration.waves[i];
+  }
+  if (count[0] > 0 && count[1] > 0) {
+    calibration.zero = calibrateLimit((sum[0] + count[0] / 2) / count[0], WAVE_ZERO * 4, CALIBRATE_WAVE_MOVE);
+    calibration.one = calibrateLimit((sum[1] + count[1] / 2) / count[1], WAVE_ONE * 4, CALIBRATE_WAVE_MOVE);
+  }
+
+  for (v = 0; v < 2; v++) {
+    unsigned char single = calibration.single[v];
+    unsigned long runSum = 0;
+    unsigned long runCount = 0;
+    for (i = 1; i < RUN_LENGTHS; i++) {
+      unsigned int n = calibration.runs[v][i];
+      if (i * 8 < single || i * 8 >= 5 * single) {
+        continue;
+      }
+      if (i * 8 < 3 * single) {
+        runSum += (unsigned long)n * i * 4;
+        runCount += n;
+      }
+      else {
+        runSum += (unsigned long)n * i * 4;
+        runCount += 2UL * n;
+      }
+    }
+    if (runCount > 0) {
+      calibration.single[v] = calibrateLimit((runSum + runCount / 2) / runCount, RUN_SINGLE * 4, CALIBRATE_RUN_MOVE);
+    }
+  }
+
+  calibrateHalve();
+  calibration.frames = 0;
+  calibration.updates++;
+  decodeTables();
+}
+#endif
+
+/****************************** MANCHESTER TABLE ******************************\
+| Decodes eight bits of single bit manchester code at once. Each pair of bits  |
+| in the index, high bits first, is 10 for a 1 or 01 for a 0. The value is    |
+| the four decoded bits, or MANCHESTER_INVALID if any pair is 00 or 11        |
+\******************************************************************************/
+const unsigned char manchesterTable[256] PROGMEM = {
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x01, 0xFF, 0xFF, 0x02, 0x03, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x04, 0x05, 0xFF, 0xFF, 0x06, 0x07, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x08, 0x09, 0xFF, 0xFF, 0x0A, 0x0B, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x0C, 0x0D, 0xFF, 0xFF, 0x0E, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+
+/*********************************** DECODER **********************************\
+| decodeWave(decoder*,char) turns pulse counts into a frame one wave at a     |
+| time, it is used for both a full capture buffer and the streaming decoder   |
+| 1) Looks up the value of the wave (0,1) in waveValue                         |
+| 2) Counts how many waves in a row have the same value, when the value       |
+|     changes decoderGroup looks up in runAction if the group was a start tag |
+|     or one or two bits of single bit manchester code                         |
+| 3) Each byte of eight manchester bits is decoded through manchesterTable as |
+|     soon as it is full                                                       |
+| 4) When the runTagMin'th 0 of the end tag arrives decoderEnd finishes the   |
+|     frame, decodeWave returns 1 and the finished frame is in decoder->frame |
+|     if all 45 bits were read                                                 |
+| Only the wave in the middle of a group stays in decodeWave, so its path is  |
+| short and, with CALIBRATE off, keeps nothing in a register across a call     |
+\******************************************************************************/
+
+/******************************** DECODER RESET *******************************\
+| Puts a decoder back in the state it starts in                                |
+\******************************************************************************/
+void decoderReset (struct decoder * decoder) {
+  decoder->state = STREAM_SEARCHING;
+  decoder->value = 0;
+  decoder->inARow = 0;
+  decoder->halfBits = 0;
+}
+
+void decoderHalfBit (struct decoder * decoder, unsigned char value) {
+  unsigned char nibble;
+  unsigned char i;
+  if (decoder->halfBits >= FRAME_HALF_BITS) {
+    return;
+  }
+  decoder->halfByte = (decoder->halfByte << 1) | value;
+  decoder->halfBits++;
+  if (decoder->halfBits == FRAME_HALF_BITS) {
+    // the last bit, the parity bit ([88][89]), is only one pair
+    if ((decoder->halfByte & 0x03) == 0x02) {
+      decoder->frame[FRAME_BYTES - 1] |= 0x08;
+    }
+    else if ((decoder->halfByte & 0x03) != 0x01) {
+      STAT_COUNT(badManchester);
+      decoder->state = STREAM_SEARCHING;
+      STAT_STAGE(STAT_SEARCH);
+    }
+    return;
+  }
+  if ((decoder->halfBits & 0x07) != 0) {
+    return;
+  }
+  // decode each byte of manchester bits as soon as it is full
+  nibble = pgm_read_byte(&manchesterTable[decoder->halfByte]);
+  if (nibble == MANCHESTER_INVALID) {
+    // The read code is not in manchester, look for the next start tag
+    STAT_COUNT(badManchester);
+    decoder->state = STREAM_SEARCHING;
+    STAT_STAGE(STAT_SEARCH);
+    return;
+  }
+  i = (decoder->halfBits >> 3) - 1;
+  if (i & 0x01) {
+    decoder->frame[i >> 1] |= nibble;
+  }
+  else {
+    decoder->frame[i >> 1] = nibble << 4;
+  }
+}
+
+/******************************* DECODER FINISH *******************************\
+| Called at the end tag or the end of a buffer. When the parity bit is a 1 its |
+| second half, a 0, runs into the 0s after the frame and is never ended by a   |
+| change of value, so it is added here. Returns 1 if the frame is complete     |
+\******************************************************************************/
+static char decoderFinish (struct decoder * decoder) {
+  if (decoder->halfBits == FRAME_HALF_BITS - 1 && decoder->value == 0 && decoder->inARow * 8 >= calibration.single[0]) {
+    decoderHalfBit(decoder, 0);
+  }
+  return decoder->state == STREAM_READING && decoder->halfBits == FRAME_HALF_BITS;
+}
+
+/********************************* DECODER END ********************************\
+| The end tag, runTagMin 0s in a row, arrived while a frame was being read    |
+| Finishes the frame now instead of waiting for the group to end. Returns 1 if |
+| the frame is complete, a frame with missing bits is thrown away              |
+\******************************************************************************/
+char decoderEnd (struct decoder * decoder) {
+  char complete = decoderFinish(decoder);
+  if (!complete) {
+    STAT_COUNT(shortFrames);
+  }
+  decoder->state = STREAM_DONE;
+  STAT_STAGE(STAT_SEARCH);
+  #ifdef CALIBRATE
+  if (complete && ++calibration.frames >= CALIBRATE_FRAMES) {
+    calibrate();
+  }
+  #endif
+  return complete;
+}
+
+/******************************** DECODER GROUP *******************************\
+| The group of waves with the same value has ended, runAction says if it was a |
+| start tag or one or two bits. value is the value of the wave starting the    |
+| next group                                                                   |
+\******************************************************************************/
+void decoderGroup (struct decoder * decoder, unsigned char value) {
+  unsigned char action = runAction[decoder->value][decoder->inARow];
+  if (decoder->state == STREAM_READING) {
+    #ifdef CALIBRATE
+    if (decoder->value < 2 && ++calibration.runs[decoder->value][decoder->inARow] == 0x8000) {
+      // nothing has been decoded for a long time, keep the counts from
+      // running over
+      calibrateHalve();
+    }
+    #endif
+    if (action == RUN_TWO) {
+      decoderHalfBit(decoder, decoder->value);
+      action = RUN_ONE;
+    }
+    if (action == RUN_ONE && decoder->state == STREAM_READING) {
+      decoderHalfBit(decoder, decoder->value);
+    }
+    else if (action == RUN_BAD) {
+      // a group of unknown values can not be manchester code
+      STAT_COUNT(badWaves);
+      decoder->state = STREAM_SEARCHING;
+      STAT_STAGE(STAT_SEARCH);
+    }
+  }
+  else if (action == RUN_START) {
+    // Start tag found
+    STAT_COUNT(startTags);
+    decoder->state = STREAM_READING;
+    decoder->halfBits = 0;
+    STAT_STAGE(STAT_DECODE);
+    HAL_SCAN_LED();
+  }
+  decoder->inARow = 1;
+  decoder->value = value;
+}
+
+char decodeWave (struct decoder * decoder, unsigned char pulses) {
+  unsigned char value;
+  
+  if (pulses >= WAVE_VALUES) {
+    pulses = WAVE_VALUES - 1;
+  }
+  #ifdef CALIBRATE
+  if (decoder->state == STREAM_READING && ++calibration.waves[pulses] == 0x8000) {
+    // a card that never decodes a whole frame still fills the counts, keep
+    // them from running over
+    calibrateHalve();
+  }
+  #endif
+  value = waveValue[decoder->value][pulses];
+  
+  if (value != decoder->value) {
+    decoderGroup(decoder, value);
+  }
+  else if (decoder->inARow < runTagMin[value]) {
+    decoder->inARow++;
+    if (decoder->inARow == runTagMin[0] && value == 0 && decoder->state == STREAM_READING) {
+      return decoderEnd(decoder);
+    }
+  }
+  return 0;
+}
+
+/******************************* Decode Buffer *******************************\
+| decodeBuffer(decoder*,char*,found) parses through a full capture buffer in  |
+| a single pass with decodeWave and calls found() with every 45 bit frame in  |
+| it, not just the first. The decoder carries on from the last buffer, so a   |
+| frame cut in two by the end of a buffer is still read. Reset the decoder    |
+| when a capture was thrown away in between. Returns the number of frames     |
+\*****************************************************************************/
+int decodeBuffer (struct decoder * decoder, char * buffer, void (*found)(const unsigned char frame[FRAME_BYTES])) {
+  int frames = 0;
+  int i;
+  #ifdef STATS_ENABLED
+  unsigned long startTags = stats.startTags;
+  #endif
+
+  for (i = 0; i < ARRAYSIZE; i++) {
+    if (decodeWave(decoder, buffer[i])) {
+      found(decoder->frame);
+      frames++;
+    }
+  }
+  #ifdef STATS_ENABLED
+  if (stats.startTags == startTags) {
+    STAT_COUNT(noStartTag);
+  }
+  #endif
+  return frames;
+}
+
+/******************************** FRAME FORMAT ********************************\
+| Returns which of FORMATS the frame is, or FORMAT_UNKNOWN. The length of the |
+| card comes from bit 7 and the sentinel, found a byte at a time, and is then |
+| looked up in FORMATS                                                         |
+\******************************************************************************/
+unsigned char frameFormat (const unsigned char frame[FRAME_BYTES]) {
+  unsigned char bits = 37;
+  unsigned char sentinel;
+  unsigned char byte;
+  unsigned char i;
+  if (frame[0] & 0xFE) {
+    // bits 0-6 are always 0
+    return FORMAT_UNKNOWN;
+  }
+  if (frame[0] & 0x01) {
+    for (i = 1; i < FRAME_BYTES && frame[i] == 0; i++);
+    if (i == FRAME_BYTES) {
+      return FORMAT_UNKNOWN;
+    }
+    sentinel = i << 3;
+    for (byte = frame[i]; !(byte & 0x80); byte <<= 1) {
+      sentinel++;
+    }
+    bits = FRAME_HALF_BITS / 2 - 1 - sentinel;
+  }
+  switch (bits) {
+    #define FORMAT(name, bits, siteOffset, siteLength, uniqueOffset, uniqueLength) \
+    case bits: return FORMAT_##name;
+    FORMATS
+    #undef FORMAT
+  }
+  return FORMAT_UNKNOWN;
+}
+
+/******************************** FRAME PARITY ********************************\
+| Returns 1 if the frame is one of FORMATS and all of its parity checks are   |
+| right. Each check is the mask of the bits it covers, shifted to where the   |
+| card sits in the frame when it is compiled, so the covered bits of all six  |
+| bytes are xor'd together and only one byte has to be folded                 |
+\******************************************************************************/
+#define FRAME_MASK(mask) {                                   \
+  (unsigned char)((mask) >> 37), (unsigned char)((mask) >> 29), \
+  (unsigned char)((mask) >> 21), (unsigned char)((mask) >> 13), \
+  (unsigned char)((mask) >> 5),  (unsigned char)((mask) << 3) }
+
+struct parityCheck {
+  unsigned char format;             // FORMAT_ number the check is for
+  unsigned char mask[FRAME_BYTES];  // the bits of the frame it covers
+  unsigned char odd;                // 1 for odd parity, 0 for even
+};
+
+const struct parityCheck parityChecks[] PROGMEM = {
+  #define PARITY(name, mask, odd) {FORMAT_##name, FRAME_MASK(mask), odd},
+  PARITIES
+  #undef PARITY
+};
+#define PARITY_CHECKS (sizeof(parityChecks) / sizeof(parityChecks[0]))
+
+static unsigned char parity (unsigned char bits) {
+  bits ^= bits >> 4;
+  bits ^= bits >> 2;
+  bits ^= bits >> 1;
+  return bits & 0x01;
+}
+
+char frameParity (const unsigned char frame[FRAME_BYTES]) {
+  unsigned char format = frameFormat(frame);
+  unsigned char bits;
+  unsigned char i;
+  unsigned char j;
+  if (format == FORMAT_UNKNOWN) {
+    return 0;
+  }
+  for (i = 0; i < PARITY_CHECKS; i++) {
+    if (pgm_read_byte(&parityChecks[i].format) != format) {
+      continue;
+    }
+    bits = pgm_read_byte(&parityChecks[i].odd);
+    for (j = 0; j < FRAME_BYTES; j++) {
+      bits ^= frame[j] & pgm_read_byte(&parityChecks[i].mask[j]);
+    }
+    if (parity(bits)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/******************************** FRAME FIELDS ********************************\
+| Fills in the fields of the tag from where its format keeps them. Each       |
+| format gets its own case with constant offsets, so the fields are read with |
+| shifts and masks made for that format. Returns 0 if the format is unknown   |
+\******************************************************************************/
+#define FRAME_FIELD(fields, field, frame, offset, bits) \
+  (fields)->value[field] = getFrameField(frame, offset, bits); \
+  (fields)->length[field] = bits
+
+char frameFields (const unsigned char frame[FRAME_BYTES], struct tagFields * fields) {
+  fields->format = frameFormat(frame);
+  switch (fields->format) {
+    #define FORMAT(name, bits, siteOffset, siteLength, uniqueOffset, uniqueLength) \
+    case FORMAT_##name:                                                              \
+      FRAME_FIELD(fields, FIELD_MANUFACTURER, frame, 0, FORMAT_START(bits) + siteOffset); \
+      FRAME_FIELD(fields, FIELD_SITE, frame, FORMAT_START(bits) + siteOffset, siteLength); \
+      FRAME_FIELD(fields, FIELD_UNIQUE, frame, FORMAT_START(bits) + uniqueOffset, uniqueLength); \
+      return 1;
+    FORMATS
+    #undef FORMAT
+  }
+  return 0;
+}
+
+/************************************ VOTE ************************************\
+| voteFrame(vote*,frame) is called with every frame that is decoded. Frames    |
+| with bad parity are thrown away. A frame that is the same tag as the last   |
+| good one adds to its count, a different tag starts a new count. Returns 1    |
+| for every frame once VOTES_NEEDED frames have agreed, vote->agree and       |
+| vote->seen say how sure the read is. voteReset starts over                 |
+\******************************************************************************/
+void voteReset (struct vote * vote) {
+  vote->agree = 0;
+  vote->seen = 0;
+}
+
+char voteFrame (struct vote * vote, const unsigned char frame[FRAME_BYTES]) {
+  unsigned char i;
+  char same = vote->agree > 0;
+  if (vote->seen < 255) {
+    vote->seen++;
+  }
+  STAT_COUNT(frames);
+  if (!frameParity(frame)) {
+    STAT_COUNT(badParity);
+    return 0;
+  }
+  for (i = 0; i < FRAME_BYTES; i++) {
+    if (frame[i] != vote->frame[i]) {
+      same = 0;
+    }
+  }
+  if (!same) {
+    for (i = 0; i < FRAME_BYTES; i++) {
+      vote->frame[i] = frame[i];
+    }
+    vote->agree = 0;
+    vote->seen = 1;
+  }
+  if (vote->agree < 255) {
+    vote->agree++;
+  }
+  return vote->agree >= VOTES_NEEDED;
+}
+
+#ifdef HOST_BUILD
+/***************************** THREE PASS DECODE ******************************\
+| The decoder before decodeWave, three passes over the buffer and then the     |
+| manchester decoding. It is only built for make host-bench so the table      |
+| driven decoder can be compared against it                                    |
+\******************************************************************************/
+
+/************************* CONVERT RAW DATA TO BINARY *************************\
+| Converts the raw 'pulse per wave' count (5,6,or 7) to binary data (0, or 1)  |
+\******************************************************************************/
+void convertRawDataToBinary (char * buffer) {
+  int i;
+  for (i = 1; i < ARRAYSIZE; i++) {
+    if (buffer[i] == 5) {
+      buffer[i] = 0;
+    }
+    else if (buffer[i] == 7) {
+      buffer[i] = 1;
+    }
+    else if (buffer[i] == 6) {
+       buffer[i] = buffer[i-1];
+    }
+    else {
+      buffer[i] = -2;
+    }
+  }
+}
+
+/******************************* FIND START TAG *******************************\
+| This function goes through the buffer and tries to find a group of fifteen   |
+| or more 1's in a row. This sigifies the start tag. If you took the fifteen   |
+| ones in multibit they would come out to be '111' in single-bit               |
+\******************************************************************************/
+int findStartTag (char * buffer) {
+  int i;
+  int inARow = 0;
+  int lastVal = 0;
+  for (i = 0; i < ARRAYSIZE; i++) {
+    if (buffer [i] == lastVal) {
+      inARow++;
+    }
+    else {
+      // End of the group of bits with the same value
+      if (inARow >= 15 && lastVal == 1) {
+        // Start tag found
+        break;
+      }
+      // group of bits was not a start tag, search next tag
+      inARow = 1;
+      lastVal = buffer[i];
+    }
+  }
+  return i;
+}
+
+/************************ PARSE MULTIBIT TO SINGLE BIT ************************\
+| This function takes in the start tag and starts parsing the multi-bit code   |
+| to produce the single bit result in the outputBuffer array the resulting     |
+| code is single bit manchester code. The bits are packed eight to a byte,    |
+| first bit in the high bit of outputBuffer[0]. Returns the number of bits    |
+| parsed before the end tag, a group of unknown (-2) values ends the parsing  |
+\******************************************************************************/
+int parseMultiBitToSingleBit (char * buffer, int startOffset, unsigned char outputBuffer[12]) {
+  int i = startOffset; // the offset value of the start tag
+  int lastVal = 0; // what was the value of the last bit
+  int inARow = 0; // how many identical bits are in a row// this may need to be 1 but seems to work fine
+  int resultArray_index = 0;
+  int bits;
+  for (bits = 0; bits < 12; bits++) {
+    outputBuffer[bits] = 0;
+  }
+  for (;i < ARRAYSIZE; i++) {
+    if (buffer [i] == lastVal) {
+      inARow++;
+    }
+    else {
+      // End of the group of bits with the same value
+      bits = 0;
+      if (inARow >= 4 && inARow <= 8) {
+        // there are between 4 and 8 bits of the same value in a row
+        // Add one bit to the resulting array
+        bits = 1;
+      }
+      else if (inARow >= 9 && inARow <= 14) {
+        // there are between 9 and 14 bits of the same value in a row
+        // Add two bits to the resulting array
+        bits = 2;
+      }
+      else if (inARow >= 15 && lastVal == 0) {
+        // there are more then 15 identical bits in a row, and they are 0s
+        // this is an end tag
+        break;
+      }
+      for (; bits > 0; bits--) {
+        if (lastVal == 1) {
+          outputBuffer[resultArray_index >> 3] |= 0x80 >> (resultArray_index & 0x07);
+        }
+        else if (lastVal != 0) {
+          return resultArray_index;
+        }
+        resultArray_index++;
+      }
+      // group of bits was not the end tag, continue parsing data
+      inARow = 1;
+      lastVal = buffer[i];
+      if (resultArray_index >= 88) {
+        // the rest is the parody bit and would run past the end of the array
+        break;
+      }
+    }
+  }
+  return resultArray_index;
+}
+
+/***************************** DECODE MANCHESTER ******************************\
+| Converts the 88 bits of single bit manchester code (100110) in halfBits to  |
+| the 44 bit binary code (010) in frame, a byte of manchester code at a time. |
+| Returns 0 if fewer then 88 bits were parsed or if any pair of bits is not   |
+| manchester code. The parody bit ([88][89]) is ignored                       |
+\*****************************************************************************/
+int decodeManchester (const unsigned char halfBits[12], int length, unsigned char frame[FRAME_BYTES]) {
+  int i;
+  unsigned char nibble;
+  
+  // Error checking, see if there are any unset bits
+  if (length < 88) {
+    return 0;
+  }
+  for (i = 0; i < 11; i++) {
+    nibble = pgm_read_byte(&manchesterTable[halfBits[i]]);
+    if (nibble == MANCHESTER_INVALID) {
+      // The read code is not in manchester, ignore this read tag and try again
+      return 0;
+    }
+    if (i & 0x01) {
+      frame[i >> 1] |= nibble;
+    }
+    else {
+      frame[i >> 1] = nibble << 4;
+    }
+  }
+  return 1;
+}
+#endif
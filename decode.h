@@ -0,0 +1,199 @@
+ /*****************************************************************************\ 
+ |         This program was written by Asher Glick aglick@tetrakai.com         | 
+ |             This program is currently under the GNU GPL licence             |
+ \*****************************************************************************/
+
+#ifndef DECODE_H
+#define DECODE_H
+
+#ifndef ARRAYSIZE
+#define ARRAYSIZE 700   // Number of RF points to collect in each buffer
+#endif
+
+#define FRAME_BYTES 6          // a 45 bit frame packed eight bits to a byte
+#define FRAME_HALF_BITS 90     // single bit manchester bits in a 45 bit frame
+#define MANCHESTER_INVALID 0xFF // manchesterTable value for bad manchester code
+
+/****************************** DECODER SETTINGS ******************************\
+| How many 125kHz pulses are in each kind of wave and how many waves in a row  |
+| make up one bit of manchester code. These depend on the tags being read,    |
+| with CALIBRATE they are only where the decoder starts                       |
+\******************************************************************************/
+#define WAVE_ZERO 5        // pulses in a wave that is a 0
+#define WAVE_ONE  7        // pulses in a wave that is a 1. A wave halfway between
+                           // the two is on the edge of a bit, it has the same
+                           // value as the wave before it
+#define RUN_SINGLE 6       // waves in a row that are one manchester bit. A group
+                           // of half to one and a half times this is one bit, up
+                           // to two and a half times is two bits and longer is a
+                           // start or end tag
+
+#define CALIBRATE          // move the thresholds to match the waves being read,
+                           // for readers with a drifting clock or poor tuning
+#define CALIBRATE_FRAMES 8 // frames read between each move of the thresholds
+#define CALIBRATE_WAVE_MOVE 2 // most the wave centres move from WAVE_ZERO and
+                              // WAVE_ONE, in quarters of a pulse. Half a pulse
+                              // follows a clock 5% slow or fast
+#define CALIBRATE_RUN_MOVE 4  // most the bit lengths move from RUN_SINGLE, in
+                              // quarters of a wave. Bits of 1s are nearer 5
+                              // waves than 6, and need the whole wave
+
+#define VOTES_NEEDED 2     // frames in a row that have to be the same tag, with
+                           // good parity, before the tag is reported
+
+/***************************** CREDENTIAL FORMATS *****************************\
+| The card formats that can be read. Bits 0-6 of a frame are 0 and bit 7 is 1 |
+| if the card is shorter than 37 bits. A shorter card has a 1, the sentinel,  |
+| just before its first bit, a 37 bit card starts at bit 8. Either way the    |
+| card's bits are the last bits of the frame, so the sentinel gives the length |
+|                                                                              |
+| FORMAT(name, bits, site offset, site length, unique offset, unique length)  |
+|   the offsets count from the first bit of the card, not of the frame. The   |
+|   bits of the frame before the site code are the manufacturer id            |
+| PARITY(name, mask, odd)                                                      |
+|   a parity check of the card, mask is the bits it covers including the      |
+|   parity bit, with the card's last bit as the lowest bit of mask. odd is 1   |
+|   if the covered bits have an odd number of 1s, 0 if even                    |
+|                                                                              |
+| Only these formats are ever reported. A frame of any other length fails      |
+| frameParity, so a new card type needs its FORMAT and PARITY lines here, see  |
+| Doc/formats.md                                                               |
+\******************************************************************************/
+#define FORMATS                                                  \
+  FORMAT(H10301, 26, 1,  8,  9, 16) /* HID 26 bit            */ \
+  FORMAT(C1000,  35, 2, 12, 14, 20) /* HID Corporate 1000    */ \
+  FORMAT(H10304, 37, 1, 16, 17, 19) /* HID 37 bit facility   */
+
+#define PARITIES                       \
+  PARITY(H10301, 0x0003FFE000ULL, 0)   \
+  PARITY(H10301, 0x0000001FFFULL, 1)   \
+  PARITY(C1000,  0x03B6DB6DB6ULL, 0)   \
+  PARITY(C1000,  0x036DB6DB6DULL, 1)   \
+  PARITY(C1000,  0x07FFFFFFFFULL, 1)   \
+  PARITY(H10304, 0x1FFFFC0000ULL, 0)   \
+  PARITY(H10304, 0x000007FFFFULL, 1)
+
+// these settings are used internally by the decoder
+#define WAVE_VALUES 16     // pulse counts in waveValue, more is WAVE_UNKNOWN
+#define WAVE_UNKNOWN 2     // waveValue for a pulse count that is not a bit
+#define WAVE_REPEAT  3     // waveValue for a wave on the edge of a bit
+
+#define RUN_LENGTHS 24     // longest group of waves runAction covers, a tag can
+                           // be at most RUN_LENGTHS - 1 waves
+
+#define RUN_NONE  0        // runAction for a group that is not a bit
+#define RUN_ONE   1        // runAction for one manchester bit
+#define RUN_TWO   2        // runAction for two manchester bits
+#define RUN_START 3        // runAction for a start tag
+#define RUN_BAD   4        // runAction for a bit of unknown values
+
+#define STREAM_SEARCHING 0 // looking for a start tag
+#define STREAM_READING   1 // parsing the manchester code after a start tag
+#define STREAM_DONE      2 // the end tag was found, the frame is finished
+
+/*********************************** DECODER **********************************\
+| Everything decodeWave needs to remember between waves                        |
+\******************************************************************************/
+struct decoder {
+  unsigned char frame[FRAME_BYTES]; // the decoded frame
+  unsigned char state;     // STREAM_SEARCHING, STREAM_READING or STREAM_DONE
+  unsigned char value;     // value of the current group of waves
+  unsigned char inARow;    // how many waves are in the current group
+  unsigned char halfBits;  // number of single bit manchester bits parsed
+  unsigned char halfByte;  // manchester bits waiting to be decoded
+};
+
+/*********************************** FORMAT ***********************************\
+| FORMAT_ and a format's name is its number, frameFormat returns it            |
+\******************************************************************************/
+enum {
+  #define FORMAT(name, bits, siteOffset, siteLength, uniqueOffset, uniqueLength) FORMAT_##name,
+  FORMATS
+  #undef FORMAT
+  FORMAT_COUNT
+};
+#define FORMAT_UNKNOWN 0xFF // frameFormat of a frame that is not one of FORMATS
+#define FORMAT_START(bits) (FRAME_HALF_BITS / 2 - (bits)) // first bit of the card
+
+/********************************* TAG FIELDS *********************************\
+| The parts of a tag that are output, taken from where its format keeps them  |
+\******************************************************************************/
+#define FIELD_MANUFACTURER 0 // the bits before the site code
+#define FIELD_SITE         1 // the site, or facility, code
+#define FIELD_UNIQUE       2 // the card number
+#define FIELDS 3
+
+struct tagFields {
+  unsigned char format;          // FORMAT_ number of the tag
+  unsigned long value[FIELDS];   // each field as a number
+  unsigned char length[FIELDS];  // how many bits each field has
+};
+
+/********************************* CALIBRATION ********************************\
+| Where the thresholds are now and the waves they are worked out from. The    |
+| centres are in quarters, of a pulse or of a wave, so they can move by less  |
+| than one                                                                     |
+\******************************************************************************/
+struct calibration {
+  unsigned char zero;      // pulses in a 0 wave, in quarters
+  unsigned char one;       // pulses in a 1 wave, in quarters
+  unsigned char single[2]; // waves in one manchester bit of 0s and of 1s, in
+                           // quarters
+  unsigned int updates;    // times the thresholds have been moved
+  #ifdef CALIBRATE
+  unsigned char frames;                 // frames read since the last move
+  unsigned int waves[WAVE_VALUES];      // pulse counts of the waves in frames
+  unsigned int runs[2][RUN_LENGTHS];    // lengths of the groups of 0s and 1s
+  #endif
+};
+extern struct calibration calibration;
+
+/************************************ VOTE ************************************\
+| The tag that frames are being compared to and how many agreed with it        |
+\******************************************************************************/
+struct vote {
+  unsigned char frame[FRAME_BYTES]; // the tag being voted on
+  unsigned char agree;     // frames with good parity that were this tag
+  unsigned char seen;      // frames decoded since this tag was first seen
+};
+
+void decodeInit (void);
+void decoderReset (struct decoder * decoder);
+char decodeWave (struct decoder * decoder, unsigned char pulses);
+int decodeBuffer (struct decoder * decoder, char * buffer, void (*found)(const unsigned char frame[FRAME_BYTES]));
+unsigned char frameFormat (const unsigned char frame[FRAME_BYTES]);
+char frameParity (const unsigned char frame[FRAME_BYTES]);
+char frameFields (const unsigned char frame[FRAME_BYTES], struct tagFields * fields);
+void voteReset (struct vote * vote);
+char voteFrame (struct vote * vote, const unsigned char frame[FRAME_BYTES]);
+
+#ifdef HOST_BUILD
+// The three pass decoder decodeWave replaced, for make host-bench
+void convertRawDataToBinary (char * buffer);
+int findStartTag (char * buffer);
+int parseMultiBitToSingleBit (char * buffer, int startOffset, unsigned char outputBuffer[12]);
+int decodeManchester (const unsigned char halfBits[12], int length, unsigned char frame[FRAME_BYTES]);
+#endif
+
+// Reading a packed frame
+#define FRAME_BIT(frame, bit) (((frame)[(bit) >> 3] >> (7 - ((bit) & 0x07))) & 0x01)
+
+/******************************* GET FRAME FIELD ******************************\
+| Returns the 'length' bits of the frame starting at bit 'offset' as a number, |
+| first bit highest. Only the bytes the field is in are read, then it is       |
+| shifted and masked into place. length can be up to 24. It is inline so when |
+| offset and length are constants, as they are for each format, it compiles  |
+| down to the few byte loads and shifts of that one field                      |
+\******************************************************************************/
+static inline unsigned long getFrameField (const unsigned char frame[FRAME_BYTES], unsigned char offset, unsigned char length) {
+  unsigned char end = offset + length; // one past the last bit of the field
+  unsigned char i;
+  unsigned long value = 0;
+  for (i = offset >> 3; i < ((end + 7) >> 3); i++) {
+    value = (value << 8) | frame[i];
+  }
+  value >>= (8 - (end & 0x07)) & 0x07;
+  return value & ((1UL << length) - 1);
+}
+
+#endif
@@ -0,0 +1,283 @@
+ /*****************************************************************************\ 
+ |         This program was written by Asher Glick aglick@tetrakai.com         | 
+ |             This program is currently under the GNU GPL licence             |
+ \*****************************************************************************/
+
+/********************************* EVENT LOG **********************************\
+| Keeps every tag that was checked against the whitelist, whether it opened    |
+| the door and when, in EEPROM, so the reads are still there for a host that   |
+| was not listening or after a reset. Each record is the tag packed like a     |
+| frame with the result in its last four bits, the time and a CRC-8:           |
+|   tag (6 bytes), time in seconds (4 bytes), CRC                              |
+| The records are a ring that is written all the way round, so each byte of    |
+| EEPROM is only written once every EVENT_RECORDS reads.                       |
+|                                                                              |
+| A byte of EEPROM takes 3.4ms to write, so eventLog only copies the record    |
+| into SRAM and the EEPROM ready interrupt writes it one byte at a time in the |
+| background. The CRC is written last, a record that was only partly written   |
+| when the power went out is never read. It is stored inverted so an erased    |
+| or zeroed record does not look like one                                      |
+\******************************************************************************/
+
+#include <avr/eeprom.h>
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <util/atomic.h>
+#include <util/crc16.h>
+
+#include "events.h"
+#include "sched.h"
+
+#ifdef EVENTS_ENABLED
+
+unsigned char eventRecords[EVENT_RECORDS][EVENT_RECORD_BYTES] EEMEM;
+
+unsigned char eventWrites[EVENT_PENDING][EVENT_RECORD_BYTES]; // records waiting
+unsigned char eventFirst;            // the record being written
+volatile unsigned char eventWaiting; // number of records waiting
+unsigned char eventByte;             // next byte of it to write
+volatile unsigned char eventHead;    // EEPROM record the next one goes in
+volatile unsigned char eventStored;  // records in EEPROM, the newest is just
+                                     // before eventHead
+volatile char eventPaused;           // store.c is using the EEPROM
+unsigned int eventDropped;
+volatile unsigned char eventWrittenOver;
+
+unsigned long eventSeconds;  // the time, counted on by eventNow
+unsigned int eventCountedAt; // schedNow() when eventSeconds was counted on
+unsigned int eventMs;        // ms counted since the last whole second
+
+static unsigned char recordCrc (const unsigned char record[EVENT_RECORD_BYTES]) {
+  unsigned char crc = 0;
+  unsigned char i;
+  for (i = 0; i < EVENT_CRC_BYTE; i++) {
+    crc = _crc8_ccitt_update(crc, record[i]);
+  }
+  return ~crc;
+}
+
+static unsigned long recordTime (const unsigned char record[EVENT_RECORD_BYTES]) {
+  unsigned long time = 0;
+  unsigned char i;
+  for (i = 0; i < 4; i++) {
+    time = (time << 8) | record[EVENT_TIME_BYTE + i];
+  }
+  return time;
+}
+
+/********************************* EVENT READY ********************************\
+| Runs each time the EEPROM can take another byte and writes exactly one, so   |
+| it is short and the same length every time. The bytes are not read first to  |
+| skip the ones that hold the right value, each slot is only written once      |
+| every EVENT_RECORDS reads anyway. It turns itself off when nothing is        |
+| waiting or store.c has paused it                                             |
+\******************************************************************************/
+ISR(EE_READY_vect) {
+  unsigned char * record = eventWrites[eventFirst];
+  unsigned char * address;
+  if (eventPaused || eventWaiting == 0) {
+    EECR &= ~(1 << EERIE);
+    return;
+  }
+  // the oldest record is written over once the ring is full
+  if (eventByte == 0 && eventStored == EVENT_RECORDS) {
+    eventStored--;
+    eventWrittenOver++;
+  }
+  address = eventRecords[eventHead];
+  EEAR = (unsigned int)(address + eventByte);
+  EEDR = record[eventByte];
+  EECR |= (1 << EEMPE);
+  EECR |= (1 << EEPE);
+  eventByte++;
+  if (eventByte == EVENT_RECORD_BYTES) {
+    eventByte = 0;
+    eventFirst = eventFirst + 1 == EVENT_PENDING ? 0 : eventFirst + 1;
+    eventWaiting--;
+    eventHead = eventHead + 1 == EVENT_RECORDS ? 0 : eventHead + 1;
+    eventStored++;
+  }
+}
+
+/********************************* EVENT INIT *********************************\
+| Reads every record once to find where the ring was left. The records go up   |
+| in time from the oldest to the newest, so the newest is the last good        |
+| record before one that is older or not good. The time carries on from it,    |
+| so it keeps going up across resets                                           |
+\******************************************************************************/
+static void eventTick (void);
+
+void eventInit (void) {
+  unsigned char record[EVENT_RECORD_BYTES];
+  unsigned long firstTime = 0;
+  unsigned long lastTime = 0;
+  char firstGood = 0;
+  char lastGood = 0;
+  unsigned char newest = EVENT_RECORDS - 1;
+  unsigned char i;
+  eventStored = 0;
+  for (i = 0; i < EVENT_RECORDS; i++) {
+    char good;
+    unsigned long time;
+    eeprom_read_block(record, eventRecords[i], EVENT_RECORD_BYTES);
+    good = record[EVENT_CRC_BYTE] == recordCrc(record);
+    time = recordTime(record);
+    if (i == 0) {
+      firstGood = good;
+      firstTime = time;
+    }
+    else if (lastGood && (!good || time < lastTime)) {
+      newest = i - 1;
+    }
+    if (good) {
+      eventStored++;
+    }
+    lastGood = good;
+    lastTime = time;
+  }
+  // the ring wraps from the last record to the first
+  if (lastGood && (!firstGood || firstTime < lastTime)) {
+    newest = EVENT_RECORDS - 1;
+  }
+  eventHead = newest + 1 == EVENT_RECORDS ? 0 : newest + 1;
+  eventSeconds = 0;
+  if (eventStored) {
+    eeprom_read_block(record, eventRecords[newest], EVENT_RECORD_BYTES);
+    eventSeconds = recordTime(record) + 1;
+  }
+  eventWaiting = 0;
+  eventFirst = 0;
+  eventByte = 0;
+  eventCountedAt = schedNow();
+  eventMs = 0;
+  schedAfter(eventTick, EVENT_TICK_MS);
+}
+
+/********************************** EVENT NOW *********************************\
+| Returns the time in seconds the reader has been running, added up over every |
+| power up since the log was started. It is counted from the millisecond tick  |
+| so it is only as good as the tick, and it stops while the power is off       |
+\******************************************************************************/
+unsigned long eventNow (void) {
+  unsigned int now = schedNow();
+  eventMs += now - eventCountedAt;
+  eventCountedAt = now;
+  while (eventMs >= 1000) {
+    eventMs -= 1000;
+    eventSeconds++;
+  }
+  return eventSeconds;
+}
+
+// counts the time on often enough that the millisecond tick can not wrap
+static void eventTick (void) {
+  eventNow();
+  schedAfter(eventTick, EVENT_TICK_MS);
+}
+
+/********************************** EVENT LOG *********************************\
+| Queues a record of frame and whether it opened the door to be written to     |
+| EEPROM, and returns right away. If EVENT_PENDING records are already         |
+| waiting it is counted in eventDropped instead                                |
+\******************************************************************************/
+void eventLog (const unsigned char frame[FRAME_BYTES], char granted) {
+  unsigned long time = eventNow();
+  unsigned char * record;
+  unsigned char slot;
+  unsigned char i;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    slot = eventFirst + eventWaiting;
+  }
+  if (eventWaiting == EVENT_PENDING) {
+    eventDropped++;
+    return;
+  }
+  record = eventWrites[slot >= EVENT_PENDING ? slot - EVENT_PENDING : slot];
+  for (i = 0; i < FRAME_BYTES; i++) {
+    record[i] = frame[i];
+  }
+  record[FRAME_BYTES - 1] = (frame[FRAME_BYTES - 1] & EVENT_TAG_MASK)
+                          | (granted ? EVENT_GRANTED : EVENT_DENIED);
+  for (i = 0; i < 4; i++) {
+    record[EVENT_TIME_BYTE + i] = time >> (24 - i * 8);
+  }
+  record[EVENT_CRC_BYTE] = recordCrc(record);
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    eventWaiting++;
+    if (!eventPaused) {
+      EECR |= (1 << EERIE);
+    }
+  }
+}
+
+// Returns 1 if no record is waiting to be written and the EEPROM is not busy
+char eventIdle (void) {
+  return eventWaiting == 0 && eeprom_is_ready();
+}
+
+/**************************** EVENT PAUSE AND RESUME **************************\
+| The EEPROM can not be read, or written by anyone else, while the interrupt   |
+| is writing to it. eventPause waits for the byte being written, at most       |
+| 3.4ms, and keeps the interrupt from starting another until eventResume       |
+\******************************************************************************/
+void eventPause (void) {
+  eventPaused = 1;
+  while (!eeprom_is_ready());
+}
+
+void eventResume (void) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    eventPaused = 0;
+    if (eventWaiting) {
+      EECR |= (1 << EERIE);
+    }
+  }
+}
+
+/********************************* EVENT COUNT ********************************\
+| The number of records in the log, the ones in EEPROM and the ones waiting    |
+\******************************************************************************/
+unsigned char eventCount (void) {
+  unsigned char count;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    count = eventStored + eventWaiting;
+  }
+  return count;
+}
+
+/********************************* EVENT READ *********************************\
+| Reads the record at position, 0 is the oldest and eventCount()-1 the newest. |
+| Returns 0 if the record is not good, it was being written over               |
+\******************************************************************************/
+char eventRead (unsigned char position, unsigned char record[EVENT_RECORD_BYTES]) {
+  unsigned char slot;
+  unsigned char i;
+  char stored;
+  eventPause();
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    stored = position < eventStored;
+    if (stored) {
+      slot = eventHead + EVENT_RECORDS - eventStored + position;
+      if (slot >= EVENT_RECORDS) {
+        slot -= EVENT_RECORDS;
+      }
+    }
+    else {
+      slot = eventFirst + position - eventStored;
+      if (slot >= EVENT_PENDING) {
+        slot -= EVENT_PENDING;
+      }
+    }
+  }
+  if (stored) {
+    eeprom_read_block(record, eventRecords[slot], EVENT_RECORD_BYTES);
+  }
+  else {
+    for (i = 0; i < EVENT_RECORD_BYTES; i++) {
+      record[i] = eventWrites[slot][i];
+    }
+  }
+  eventResume();
+  return record[EVENT_CRC_BYTE] == recordCrc(record);
+}
+#endif
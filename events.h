@@ -0,0 +1,51 @@
+ /*****************************************************************************\ 
+ |         This program was written by Asher Glick aglick@tetrakai.com         | 
+ |             This program is currently under the GNU GPL licence             |
+ \*****************************************************************************/
+
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include "decode.h"
+
+/******************************* EVENT SETTINGS *******************************\
+| Uncomment EVENTS_ENABLED to keep every read checked against the whitelist   |
+| in EEPROM, it needs Whitelist_Enabled in main.c. The log keeps the last      |
+| EVENT_RECORDS reads and EVENT_PENDING can wait in SRAM to be written. Each   |
+| takes 11 bytes. With the 64 credentials of store.h the log fills 1000 of     |
+| the 1024 bytes of EEPROM                                                     |
+\******************************************************************************/
+//#define EVENTS_ENABLED
+#define EVENT_RECORDS 56   // reads kept in EEPROM, the oldest is written over
+#define EVENT_PENDING 4    // reads waiting to be written
+#define EVENT_TICK_MS 1000 // how often the time is counted on, under 65s
+
+// these settings are used internally by the log
+#define EVENT_RECORD_BYTES (FRAME_BYTES + 5) // the tag, the time and a CRC
+#define EVENT_TIME_BYTE FRAME_BYTES          // the time, high byte first
+#define EVENT_CRC_BYTE (FRAME_BYTES + 4)
+#define EVENT_TAG_MASK    0xF0 // bits of the last tag byte that are the tag
+#define EVENT_RESULT_MASK 0x0F // bits of the last tag byte that are the result
+#define EVENT_DENIED  0x00     // searchTag did not find the tag
+#define EVENT_GRANTED 0x01     // searchTag found it and the door was opened
+
+#ifdef EVENTS_ENABLED
+extern unsigned int eventDropped; // reads not logged, EVENT_PENDING were waiting
+extern volatile unsigned char eventWrittenOver; // oldest records written over,
+                                                // wraps at 256
+
+void eventInit (void);
+void eventLog (const unsigned char frame[FRAME_BYTES], char granted);
+char eventIdle (void);
+unsigned long eventNow (void);
+unsigned char eventCount (void);
+char eventRead (unsigned char position, unsigned char record[EVENT_RECORD_BYTES]);
+void eventPause (void);
+void eventResume (void);
+#else
+// store.c pauses the log around its own EEPROM use
+#define eventPause()
+#define eventResume()
+#endif
+
+#endif
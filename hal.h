@@ -0,0 +1,33 @@
+ /*****************************************************************************\ 
+ |         This program was written by Asher Glick aglick@tetrakai.com         | 
+ |             This program is currently under the GNU GPL licence             |
+ \*****************************************************************************/
+
+/************************* HARDWARE ABSTRACTION LAYER *************************\
+| Everything the decode functions need from the hardware goes through here.   |
+| When HOST_BUILD is defined (make host-bench) they are built for the PC and  |
+| these do nothing or read memory directly                                     |
+\******************************************************************************/
+#ifndef HAL_H
+#define HAL_H
+
+#ifndef HOST_BUILD
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+#define HAL_SCAN_LED() (PORTB |= 0x10) // turn an led on on pin B5
+
+#else
+
+#define HAL_SCAN_LED()
+
+// tables are kept in flash on the AVR and read with pgm_read_byte
+#define PROGMEM
+#define pgm_read_byte(address) (*(const unsigned char *)(address))
+#define pgm_read_dword(address) (*(const unsigned long *)(address))
+#define memcmp_P memcmp
+
+#endif
+
+#endif
@@ -37,6 +37,9 @@
 //#define Binary_Tag_Output         // Outputs the Read tag in binary over serial
 #define Hexadecimal_Tag_Output    // Outputs the read tag in Hexadecimal over serial
 //#define Decimal_Tag_Output        // Outputs the read tag in decimal
+//#define Binary_Frame_Output       // Outputs the read tag as a 13 byte packet
+                                  // for a host to parse (see Doc/packets.md),
+                                  // turn the three outputs above off with it
 
 #define Manufacturer_ID_Output    // The output will contain the Manufacturer ID (NOT IMPLEMENTED)
 #define Site_Code_Output          // The output will contain the Site Code       (NOT IMPLEMENTED)
@@ -44,9 +47,46 @@
 
 //#define Split_Tags_With '-'       // The character to split tags pieces with
 
+#define Removed_Events            // Sends "REMOVED" and the tag when a tag that
+                                  // was reported has left the reader, see
+                                  // CACHE_HOLD_MS in cache.h
+
+//#define Confidence_Output         // Adds how many frames agreed out of how many
+                                  // were decoded to the end of each tag line,
+                                  // " 2/3", see VOTES_NEEDED in decode.h
+
 //#define Whitelist_Enabled         // When a tag is read it will be compaired 
                                   // against a whitelist and one of two functions
                                   // will be run depending on if the id matches
+                                  // (the whitelist is read from whitelist.csv)
+
+#define Streaming_Decoder         // Decode each wave as it arrives instead of
+                                  // filling a buffer and analizing it with
+                                  // interrupts turned off
+
+//#define Input_Capture_Demod       // Time each DEMOD_OUT wave with the Timer1
+                                  // input capture (ICP1 is PB0) instead of
+                                  // interrupting on every 125kHz pulse on INT0
+
+//#define Second_Channel            // Read a second antenna whose DEMOD_OUT is on
+                                  // PC0, each tag is sent with the number of
+                                  // the antenna that read it. Needs
+                                  // Input_Capture_Demod and Streaming_Decoder,
+                                  // and CALIBRATE off in decode.h (see
+                                  // Doc/channels.md)
+
+//#define Raw_Capture_Stream        // The D command streams the waves as they
+                                  // are captured, 2 bits each, for a host to
+                                  // record and replay (see Doc/rawstream.md).
+                                  // Needs Serial_Commands, BAUD is 76800
+
+#define Serial_Commands           // Read commands sent over serial to add,
+                                  // remove and list the whitelist tags kept
+                                  // in EEPROM (see Doc/commands.md)
+
+//#define Low_Power_Idle            // Sleep in power down between cards and wake
+                                  // on DEMOD_OUT changing, a serial byte or a
+                                  // watchdog probe (see Doc/power.md)
                                  
                                  
                                  // some conststents
@@ -55,20 +95,23 @@
 #define SERVO_OPEN 575    // open signal value for the servo
 #define SERVO_CLOSE 1000  // close signal value for the servo
 
+// How long each part of opening the door takes, in milliseconds
+#define DOOR_OPEN_MS 3000 // how long the door stays open
+#define SERVO_MOVE_MS 500 // how long the servo takes to close before it idles
+#define DENIED_LED_MS 1000 // how long the red led stays on for a denied tag
+#define BUTTON_POLL_MS 10 // how often the button is checked while the door is open
+#define VOTE_TIMEOUT_MS 250 // with no frames for this long the card has gone and
+                            // the vote on which tag it is starts over
+#define CACHE_POLL_MS 100   // how often the cache is checked for removed tags
+#define IDLE_TIMEOUT_MS 2000 // with Low_Power_Idle, with no frames for this long
+                             // the reader goes to sleep. Longer than
+                             // CACHE_HOLD_MS so the removed events are sent
+#define PROBE_LISTEN_MS 80  // how long the reader listens for a frame after it
+                            // wakes up. A frame is 38.4ms, so from a random
+                            // start it takes two to be sure of a whole one
 
-//20-bit manufacturer code,
-//8-bit site code
-//16-bit unique id
-
-#define MANUFACTURER_ID_OFFSET 0
-#define MANUFACTURER_ID_LENGTH 20
-
-#define SITE_CODE_OFFSET 20
-#define SITE_CODE_LENGTH 8
-	 
-#define UNIQUE_ID_OFFSET 28
-#define UNIQUE_ID_LENGTH 16
-
+// Where the manufacturer id, site code and unique id are in each card format
+// is set by FORMATS in decode.h
 
 
 // these settings are used internally by the program to optimize the settings above
@@ -81,31 +124,196 @@
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
-#include <stdlib.h>
+#include <avr/pgmspace.h>
+#include <avr/sleep.h>
+#include <util/atomic.h>
+#include <util/crc16.h>
 
-#define ARRAYSIZE 900   // Number of RF points to collect each time
+#include "decode.h"
+#include "cache.h"
+#include "decimal.h"
+#include "events.h"
+#include "power.h"
+#include "sched.h"
+#include "stats.h"
+#include "store.h"
+#include "whitelist.h"
 
-char * begin;           // points to the bigining of the array
-int * names;            // array of valid ID numbers
-int namesize;           // size of array of valid ID numbers
-volatile int iter;      // the iterator for the placement of count in the array
+#define FOSC 8000000 // Clock Speed of the procesor
+#define CARRIER 125000 // Frequency of the RF carrier
+
+#define CAPTURE_BUFFERS 2 // Number of buffers, one is filled while another is
+                          // analized (two 900 point buffers do not fit in 2KB,
+                          // the decoder carries frames across buffers so 700
+                          // reads as many)
+
+#ifdef Second_Channel
+  #if !defined(Input_Capture_Demod) || !defined(Streaming_Decoder)
+    // counting every 125kHz pulse of two antennas leaves 32 cycles an edge
+    // and two sets of capture buffers do not fit in 2KB
+    #error "Second_Channel needs Input_Capture_Demod and Streaming_Decoder"
+  #endif
+  #ifdef CALIBRATE
+    // the thresholds are shared, a card at one antenna would move them for
+    // both and a demodulator that is a little off would pull the other one
+    #error "Second_Channel needs CALIBRATE commented out in decode.h"
+  #endif
+  #define CHANNELS 2    // antennas read at once
+  #define WAVE_QUEUE 128 // waves waiting for decodeWave on each channel, a
+                         // power of two up to 256
+#else
+  #define CHANNELS 1
+  #define WAVE_QUEUE 256
+#endif
+
+#if defined(Raw_Capture_Stream) && !defined(Serial_Commands)
+  #error "Raw_Capture_Stream is turned on with the D command, it needs Serial_Commands"
+#endif
+
+#if defined(EVENTS_ENABLED) && !defined(Whitelist_Enabled)
+  #error "EVENTS_ENABLED in events.h logs whitelist checks, it needs Whitelist_Enabled"
+#endif
+
+#ifndef Streaming_Decoder
+// the capture buffers, in .bss so nothing has to allocate or clear them at
+// reset. Each one is only analized once the interrupt has filled all of it
+char begin[CAPTURE_BUFFERS * ARRAYSIZE];
+char * captureWrite;    // where the interrupt writes the next count
+char * captureEnd;      // the end of the buffer the interrupt is filling
+unsigned char captureFill;          // which buffer the interrupt is filling
+volatile unsigned char captureHead; // number of buffers filled (wraps at 256)
+volatile unsigned char captureTail; // number of buffers analized (wraps at 256)
+unsigned char captureGap[CAPTURE_BUFFERS]; // a capture was thrown away just
+                                           // before this buffer was filled
+#endif
 volatile int count;     // counts 125kHz pulses
 volatile int lastpulse; // last value of DEMOD_OUT
 volatile int on;        // stores the value of DEMOD_OUT in the interrupt
+volatile unsigned int servoPulse; // servo pulse length in us, 0 is idle
+unsigned int servoWidth;          // length of the pulse being sent
 
-/********************************* ADD NAMES *********************************\
-| This function add allocates the ammount of memory that will be needed to    |
-| store the list of names, and adds all the saved names to the allocated      |
-| memory for use later in the program                                         |
-\*****************************************************************************/
-void addNames(void) {
-  namesize = 2; // number of IDs in the access list
-  names = malloc (sizeof(int) * namesize);
-  // change or add more IDs after this point
-  names [0] = 12345;
-  names [1] = 56101;
+/*********************************** CHANNEL **********************************\
+| Everything one antenna needs to be read on its own: the waves its interrupt  |
+| has timed, the decoder they go through and the vote on its frames. Channel   |
+| 0 is DEMOD_OUT on PB0 and channel 1, with Second_Channel, is PC0. The        |
+| decoder's thresholds, the tag cache, the whitelist and the door are shared,  |
+| so Second_Channel needs CALIBRATE off                                        |
+\******************************************************************************/
+struct channel {
+  struct decoder reader;           // the decoder its waves go through
+  #ifdef Streaming_Decoder
+  char waveQueue[WAVE_QUEUE];      // waves waiting for decodeWave
+  volatile unsigned char waveHead; // waves the interrupt has written (wraps at 256)
+  volatile unsigned char waveTail; // waves the main loop has read (wraps at 256)
+  unsigned char held[FRAME_BYTES]; // a frame decoded while a reply was sent
+  unsigned char holding;           // held is waiting for channelFrame
+  #endif
+  unsigned int lastCapture;        // Timer1 value at the start of the wave
+  struct vote vote;                // frames have to agree before a tag is reported
+  unsigned int lastFrame;          // schedNow() at the last frame, for voteExpire
+};
+struct channel channels[CHANNELS];
+unsigned char tagChannel;        // channel of the tag being reported
+#ifdef Low_Power_Idle
+unsigned int idleSince;          // schedNow() at the last frame or wake up
+unsigned int idleAfter;          // ms from idleSince the reader goes to sleep
+#endif
+#ifdef Raw_Capture_Stream
+volatile char rawOn;             // the D command has turned the raw stream on
+volatile char rawGap;            // waves were lost since the last raw packet
+unsigned char rawState;          // byte of the raw packet the USART sends next
+unsigned char rawLeft;           // waves of that packet still to be packed,
+                                 // they can not be written over
+#ifdef Streaming_Decoder
+volatile unsigned char rawTail;  // waves of channel 0 sent (wraps at 256)
+volatile unsigned char rawHole;  // the wave after those lost mid packet
+volatile char rawSkip;           // the next packet starts at rawHole
+#else
+const char * rawNext;            // the next wave of the buffer to send
+const char * rawEnd;             // the end of that buffer
+volatile char rawBusy;           // the buffer has not all been sent
+#endif
+#endif
+
+#ifndef Streaming_Decoder
+/******************************** CAPTURE FULL ********************************\
+| Called by the interrupt when the buffer it is filling is full. If there is   |
+| a free buffer the full one is handed to the main loop by moving captureHead  |
+| and the interrupt moves on to the next buffer. captureHead is only written   |
+| here and captureTail is only written by the main loop, and both are one     |
+| byte so neither side needs to turn interrupts off to read them. If the main |
+| loop is still analizing every other buffer the capture is thrown away and   |
+| the same buffer is filled again                                              |
+\******************************************************************************/
+static inline void captureFull (void) {
+  if ((unsigned char)(captureHead + 1 - captureTail) < CAPTURE_BUFFERS) {
+    captureHead = captureHead + 1;
+    captureFill = captureFill + 1;
+    if (captureFill == CAPTURE_BUFFERS) {
+      captureFill = 0;
+    }
+  }
+  else {
+    STAT_COUNT(overruns);
+    captureGap[captureFill] = 1;
+    #ifdef Raw_Capture_Stream
+    rawGap = 1;
+    #endif
+  }
+  captureWrite = begin + captureFill * ARRAYSIZE;
+  captureEnd = captureWrite + ARRAYSIZE;
+}
+#endif
+
+/********************************* STORE WAVE *********************************\
+| Called by the interrupt at the end of every wave with the number of 125kHz  |
+| pulses in it. The wave is queued for the channel's streaming decoder or      |
+| written into the capture buffer. The decoder is not run here because the     |
+| registers it uses would have to be saved on every 125kHz pulse, not just     |
+| once a wave                                                                  |
+\******************************************************************************/
+static inline void storeWave (struct channel * channel, unsigned char pulses) {
+  #ifdef Streaming_Decoder
+  // queue the wave for the decoder, if the queue is full the wave is lost
+  // and the decoder will resync on the next start tag
+  unsigned char head = channel->waveHead;
+  if ((unsigned char)(head - channel->waveTail) < WAVE_QUEUE - 1) {
+    #ifdef Raw_Capture_Stream
+    // the raw stream reads channel 0's queue too, if it has fallen behind
+    // its oldest wave is written over and the next packet says so. A packet
+    // that is being sent has already counted its waves, so then this wave
+    // is lost instead and the packet goes out whole. The next packet starts
+    // after the lost wave, so no packet has a hole in the middle
+    if (rawOn && channel == channels && (unsigned char)(head - rawTail) >= WAVE_QUEUE - 1) {
+      rawGap = 1;
+      if (rawLeft) {
+        rawHole = head;
+        rawSkip = 1;
+        STAT_COUNT(overruns);
+        return;
+      }
+      rawTail = rawTail + 1;
+    }
+    #endif
+    channel->waveQueue[head & (WAVE_QUEUE - 1)] = pulses;
+    channel->waveHead = head + 1;
+    STAT_COUNT(waves);
+  }
+  else {
+    STAT_COUNT(overruns);
+  }
+  #else
+  // write the data to the array
+  STAT_COUNT(waves);
+  *captureWrite = pulses;
+  captureWrite++;
+  if (captureWrite == captureEnd) {
+    captureFull();
+  }
+  #endif
 }
 
+#ifndef Input_Capture_Demod
 /******************************* INT0 INTERRUPT *******************************\
 | This ISR(INT0_vect) is the interrupt function for INT0. This function is the |
 | function that is run each time the 125kHz pulse goes HIGH.                   |
@@ -115,28 +323,115 @@ void addNames(void) {
 |     wave                                                                     |
 \******************************************************************************/
 ISR(INT0_vect) {
+  STAT_COUNT(edges);
   //Save the value of DEMOD_OUT to prevent re-reading on the same group
   on =(PINB & 0x01);
   // if wave is rising (end of the last wave)
   if (on == 1 && lastpulse == 0 ) {
-    // write the data to the array and reset the cound
-    begin[iter] = count; 
+    storeWave(&channels[0], count);
+    // reset the count
     count = 0;
-    iter = iter + 1;
   }
   count = count + 1;
   lastpulse = on;
 }
 
-/************************************ WAIT ************************************\
-| A generic wait function                                                      |
+
+/******************************* SERVO POSITION *******************************\
+| Sets the servo signal, 0 sets the servo to idle. The servo is driven by the  |
+| Timer1 PWM on OC1A, set on match and clear on TOP with TOP at 10000, so the  |
+| pulse is 2*position us long every 20ms                                      |
+\******************************************************************************/
+void servoPosition (unsigned int position) {
+  if (position == 0) {
+    OCR1A = 0;
+  }
+  else {
+    OCR1A = 10000 - position;
+  }
+}
+#else
+/***************************** TIMER1 INPUT CAPTURE ****************************\
+| This ISR(TIMER1_CAPT_vect) runs on each rising edge of DEMOD_OUT, the start  |
+| of a new wave. Timer1 counts microseconds so the length of the wave that     |
+| just ended divided by the length of one 125kHz pulse is the same count the   |
+| INT0 interrupt would have made, but the interrupt only runs once per wave    |
+| instead of once per pulse                                                    |
+\******************************************************************************/
+#define CAPTURE_TICKS (FOSC/8/CARRIER) // Timer1 ticks in one 125kHz pulse
+static inline void timeWave (struct channel * channel, unsigned int now) {
+  unsigned int length = now - channel->lastCapture;
+  STAT_COUNT(edges);
+  channel->lastCapture = now;
+  // round to the nearest number of pulses, anything too long to fit is 255
+  if (length >= 255 * CAPTURE_TICKS) {
+    storeWave(channel, 255);
+  }
+  else {
+    storeWave(channel, (length + CAPTURE_TICKS/2) / CAPTURE_TICKS);
+  }
+}
+
+ISR(TIMER1_CAPT_vect) {
+  timeWave(&channels[0], ICR1);
+}
+
+#ifdef Second_Channel
+/************************* SECOND CHANNEL PIN CHANGE **************************\
+| Runs on every change of the second antenna's DEMOD_OUT (PC0, PCINT8). There  |
+| is only one input capture pin so Timer1 is read here instead. That happens   |
+| after the time it takes to get into the interrupt, a few cycles, or longer   |
+| if another interrupt is running. A late read makes one wave longer and the   |
+| next one shorter by the same amount, the error does not add up               |
 \******************************************************************************/
-void wait (unsigned long time) {
-  long i;
-  for (i = 0; i < time; i++) {
-    asm volatile ("nop");
+ISR(PCINT1_vect) {
+  unsigned int now = TCNT1;
+  if (PINC & 0x01) {
+    timeWave(&channels[1], now);
   }
 }
+#endif
+
+/*************************** TIMER1 COMPARE MATCH A ***************************\
+| Timer1 is free running for the input capture so it can not also generate the |
+| servo PWM. Instead OC1A toggles on every compare match and this interrupt    |
+| moves OCR1A to the next edge, 50 times a second for each edge                |
+\******************************************************************************/
+#define SERVO_PERIOD 20000 // us between the start of each servo pulse
+ISR(TIMER1_COMPA_vect) {
+  if (PINB & 0x02) {
+    // the pulse just started, end it after servoWidth
+    OCR1A += servoWidth;
+  }
+  else if (servoPulse == 0) {
+    // the pulse just ended and the servo is set to idle, stop pulsing
+    TCCR1A = 0;
+    TIMSK1 &= ~(1 << OCIE1A);
+  }
+  else {
+    // the pulse just ended, start the next one at the end of the period
+    OCR1A += SERVO_PERIOD - servoWidth;
+    servoWidth = servoPulse;
+  }
+}
+
+/******************************* SERVO POSITION *******************************\
+| Sets the servo signal, 0 sets the servo to idle. The pulse is 2*position us  |
+| long every 20ms, the same signal the Timer1 PWM makes without input capture  |
+\******************************************************************************/
+void servoPosition (unsigned int position) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    servoPulse = position * 2;
+    if (position != 0 && !(TIMSK1 & (1 << OCIE1A))) {
+      // start pulsing, the first match sets OC1A high
+      servoWidth = servoPulse;
+      OCR1A = TCNT1 + 100;
+      TCCR1A = (1 << COM1A0);
+      TIMSK1 |= (1 << OCIE1A);
+    }
+  }
+}
+#endif
 
   //////////////////////////////////////////////////////////////////////////////
  //////////////////////////// SERIAL COMMUNICATION ////////////////////////////
@@ -145,102 +440,279 @@ void wait (unsigned long time) {
 /******************************** USART CONFIG ********************************\
 | USART_Init(void) initilizes the USART feature, this function needs to be run |
 | before any USART functions are used, this function configures the BAUD rate  |
-| for the USART and enables the format for transmission                        |
+| for the USART and enables the format for transmission. util/setbaud.h works  |
+| out the divider and turns on double speed when it gets closer to BAUD, at   |
+| 8MHz 38400 and 76800 are exact and 57600 is 2% off                          |
 \******************************************************************************/
-#define FOSC 8000000 // Clock Speed of the procesor
+#ifndef BAUD
+#ifdef Raw_Capture_Stream
+#define BAUD 76800    // the raw stream needs about 4600 bytes a second, 70% of
+                      // this, see Doc/rawstream.md
+#else
 #define BAUD 19200    // Baud rate (to change the BAUD rate change this variable
-#define MYUBRR FOSC/16/BAUD-1 // calculate the number the processor needs
+#endif
+#endif
+#define F_CPU FOSC
+#include <util/setbaud.h>
 void USART_Init(void) {
-  unsigned int ubrr = MYUBRR;
   /*Set baud rate */
-  UBRR0H = (unsigned char)(ubrr>>8);
-  UBRR0L = (unsigned char)ubrr;
+  UBRR0H = UBRRH_VALUE;
+  UBRR0L = UBRRL_VALUE;
+  #if USE_2X
+  UCSR0A |= (1<<U2X0);
+  #else
+  UCSR0A &= ~(1<<U2X0);
+  #endif
   /*Enable receiver and transmitter */
   UCSR0B = (1<<RXEN0)|(1<<TXEN0);
+  #ifdef Serial_Commands
+  UCSR0B |= (1<<RXCIE0); // interrupt on each byte received
+  #endif
   /* Set frame format: 8data, 2stop bit */
   UCSR0C = (1<<USBS0)|(3<<UCSZ00);
 }
 
 /******************************* USART_Transmit *******************************\
-| The USART_Transmit(int) function allows you to send numbers to USART serial  |
-| This function only handles numbers up to two digits. If there is one digit   |
-| the message contains a space, then the digit converted to ascii. If there    |
-| are two digits then the message is the first digit followed by the seccond   |
-| If the input is negative then the function will output a newline character   |
+| USART_Transmit(char) queues one character to be sent and returns right away, |
+| the USART data register empty interrupt sends the queue one character at a   |
+| time. If the queue is full the character is thrown away and counted in       |
+| txDropped, capture and decoding are never held up waiting for the serial    |
+| port. txOverflows counts how many times characters started being thrown     |
+| away. Between USART_LineStart and USART_LineEnd the characters are put in    |
+| the queue after txHead but the interrupt does not see them yet, see there    |
 \******************************************************************************/
+#ifndef TX_QUEUE
+#define TX_QUEUE 64 // characters waiting to be sent, a power of two
+#endif
+char txQueue[TX_QUEUE];
+volatile unsigned char txHead; // characters queued (wraps at 256)
+volatile unsigned char txTail; // characters sent by the interrupt (wraps at 256)
+unsigned int txDropped;        // characters thrown away because the queue was full
+unsigned int txOverflows;      // times the queue was full when it had not been
+char txFull;                   // the last character was thrown away
+char txSent;                   // a character has been written to UDR0
+unsigned char txLine;          // end of the line being queued, past txHead
+char txInLine;                 // a line has been started and not ended
+char txLineLost;               // part of that line did not fit
+
+// Moves txHead, or txLine while a line is being queued, on to head
+static void txQueued (unsigned char head) {
+  if (txInLine) {
+    txLine = head;
+    return;
+  }
+  txHead = head;
+  // start the interrupt, it turns itself off when the queue is empty
+  UCSR0B |= (1<<UDRIE0);
+}
+
+// Counts length characters that did not fit
+static void txLost (unsigned char length) {
+  if (!txFull) {
+    txOverflows++;
+    txFull = 1;
+  }
+  txDropped += length;
+  txLineLost = txInLine;
+}
+
 void USART_Transmit(char input )
 {
-  while ( !( UCSR0A & (1<<UDRE0)) );
-  // Put the value into the regester to send
-  UDR0 = input;
+  unsigned char head = txInLine ? txLine : txHead;
+  if (txLineLost || (unsigned char)(head - txTail) >= TX_QUEUE) {
+    txLost(1);
+    return;
+  }
+  txFull = 0;
+  txQueue[head & (TX_QUEUE - 1)] = input;
+  txQueued(head + 1);
 }
-  //////////////////////////////////////////////////////////////////////////////
- ////////////////////////// BASE CONVERSION FUNCTIONS /////////////////////////
-//////////////////////////////////////////////////////////////////////////////
-char binaryTohex (int four, int three, int two, int one) {
-  int value = (one << 0) + (two << 1) + (three << 2) + (four << 3);
-  if (value > 9) return 'A' + value - 10;
-  return '0' + value;
+
+/********************************* USART WRITE ********************************\
+| Queues length characters in one piece. If they do not all fit none of them  |
+| are queued, so a number is never sent cut off part way                      |
+\******************************************************************************/
+void USART_Write (const char * text, unsigned char length) {
+  unsigned char head = txInLine ? txLine : txHead;
+  unsigned char i;
+  if (txLineLost || (unsigned char)(TX_QUEUE - (unsigned char)(head - txTail)) < length) {
+    txLost(length);
+    return;
+  }
+  txFull = 0;
+  for (i = 0; i < length; i++) {
+    txQueue[(unsigned char)(head + i) & (TX_QUEUE - 1)] = text[i];
+  }
+  txQueued(head + length);
 }
 
-/*********************** GET HEX ARRAY FROM BINARY ARRAY **********************\
-|
+/********************************** USART LINE ********************************\
+| Queues everything sent between USART_LineStart and USART_LineEnd in one     |
+| piece, like USART_Write. The characters go in the queue after txHead, where  |
+| the interrupt does not send them. USART_LineEnd moves txHead past them once  |
+| the whole line is in. If any of it did not fit none of it is sent, so a tag  |
+| is never sent cut off part way. Only the main loop queues characters         |
 \******************************************************************************/
-int * getHexFromBinary (int * array, int length, int * result) {
-  int i;
-  int resultLength = (length+3)/4; // +3 so that the resulting number gets rounded up
-  // 4 / 4 = 1       [correct]
-  // 7 / 4 = 1 (4+3) [still correct]
-  // 5 / 4 = 1       [not rounded up]
-  // 8 / 4 = 2 (5+3) [correct]
-  
-  for (i = 0; i < resultLength; i++) {
-    result[i*4] = (array[i+0] << 0)
-                + (array[i+1] << 1)
-                + (array[i+2] << 2)
-                + (array[i+3] << 3);
+void USART_LineStart (void) {
+  txLine = txHead;
+  txLineLost = 0;
+  txInLine = 1;
+}
+
+void USART_LineEnd (void) {
+  txInLine = 0;
+  if (txLineLost) {
+    // what was queued of the line is thrown away too
+    txDropped += (unsigned char)(txLine - txHead);
+    txLineLost = 0;
+    return;
   }
-  return result;
+  txQueued(txLine);
 }
-/*************************** GET DECIMAL FROM BINARY **************************\
-| This function will take in a binary input and return an intiger with the     |
-| corrisponding value, assumed as decimal                                      |
+
+/**************************** USART UDRE INTERRUPT ****************************\
+| Runs whenever the USART can take another character to send. With the raw     |
+| stream on, a raw packet that has been started is sent before anything else   |
 \******************************************************************************/
-int getDecimalFromBinary (int * array, int length) {  
-  int result = 0;
-  int i;
-  for (i = 0; i < length; i++) {
-    result = result<<1;
-    result += array[i]&0x01;
+#ifdef Raw_Capture_Stream
+static inline char rawSend (char queueEmpty); // in RAW STREAM
+#endif
+ISR(USART_UDRE_vect) {
+  unsigned char tail = txTail;
+  #ifdef Raw_Capture_Stream
+  if (rawSend(tail == txHead)) {
+    return;
+  }
+  #endif
+  if (tail != txHead) {
+    // writing 1 clears TXC0, U2X0 is written back as it was
+    UCSR0A |= (1<<TXC0);
+    txSent = 1;
+    UDR0 = txQueue[tail & (TX_QUEUE - 1)];
+    txTail = tail + 1;
+  }
+  else {
+    UCSR0B &= ~(1<<UDRIE0);
   }
-  return result;
 }
 
+/********************************* USART IDLE *********************************\
+| Returns 1 once everything queued has been sent, the last character too, so  |
+| the USART can be stopped. TXC0 is cleared as each character is written and |
+| is set again when the USART has nothing left to send                        |
+\******************************************************************************/
+char USART_Idle (void) {
+  #ifdef Raw_Capture_Stream
+  if (rawOn || rawState != 0) {
+    return 0;
+  }
+  #endif
+  return txHead == txTail && (!txSent || (UCSR0A & (1<<TXC0)));
+}
 
+/********************************* USART ROOM *********************************\
+| Returns how many more characters fit in the transmit queue                   |
+\******************************************************************************/
+unsigned char USART_Room (void) {
+  return TX_QUEUE - (unsigned char)(txHead - txTail);
+}
 
-void recurseDecimal (unsigned int val) {
-  if (val > 0 ) {
-    recurseDecimal(val/10);
-    USART_Transmit('0'+val%10);
+/********************************* USART WAIT *********************************\
+| Waits until there is room for length more characters in the transmit queue. |
+| For long replies, like the list command, that would not fit in the queue.   |
+| The waves keep being decoded while it waits, so a long reply does not let   |
+| the wave queues overrun. Only the serial commands wait                      |
+\******************************************************************************/
+#ifdef Streaming_Decoder
+void decodeQueued (char replying); // in DECODE QUEUED
+#endif
+void USART_Wait (unsigned char length) {
+  while (USART_Room() < length) {
+    #ifdef Streaming_Decoder
+    decodeQueued(1);
+    #endif
+  }
+}
+
+/********************************* USART PRINT ********************************\
+| Sends a string kept in flash, use it with PSTR("text")                       |
+\******************************************************************************/
+void USART_Print (const char * text) {
+  char c;
+  while ((c = pgm_read_byte(text)) != '\0') {
+    USART_Transmit(c);
+    text++;
   }
-  return;
 }
 
-void printDecimal (int array[45]) {
+#ifdef Serial_Commands
+/****************************** USART RX INTERRUPT *****************************\
+| Puts each byte that is received into rxQueue for the main loop, if the queue |
+| is full the byte is lost                                                     |
+\******************************************************************************/
+#define RX_QUEUE 32 // bytes waiting to be read, a power of two
+char rxQueue[RX_QUEUE];
+volatile unsigned char rxHead; // bytes received (wraps at 256)
+volatile unsigned char rxTail; // bytes read by the main loop (wraps at 256)
+volatile unsigned int rxDropped; // bytes thrown away because the queue was full
+ISR(USART_RX_vect) {
+  char input = UDR0;
+  if ((unsigned char)(rxHead - rxTail) < RX_QUEUE) {
+    rxQueue[rxHead & (RX_QUEUE - 1)] = input;
+    rxHead = rxHead + 1;
+  }
+  else {
+    rxDropped++;
+  }
+}
+#endif
+  //////////////////////////////////////////////////////////////////////////////
+ ////////////////////////// BASE CONVERSION FUNCTIONS /////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+/********************************** HEX DIGIT *********************************\
+| Returns the ascii hex digit for the lowest four bits of value                |
+\******************************************************************************/
+char hexDigit (unsigned char value) {
+  value &= 0x0F;
+  if (value > 9) return 'A' + value - 10;
+  return '0' + value;
+}
+
+/******************************** PRINT NUMBER ********************************\
+| Sends a number in decimal. decimalFormat writes it into a buffer without    |
+| dividing and it is queued in one piece                                       |
+\******************************************************************************/
+void printNumber (unsigned long val) {
+  char digits[DECIMAL_DIGITS];
+  USART_Write(digits, decimalFormat(val, digits));
+}
+
+/******************************* PRINT LINE END *******************************\
+| Ends the line of a tag, with how many frames agreed on it first if          |
+| Confidence_Output is set                                                     |
+\******************************************************************************/
+void printLineEnd (void) {
+  #ifdef Confidence_Output
+  USART_Transmit(' ');
+  printNumber(channels[tagChannel].vote.agree);
+  USART_Transmit('/');
+  printNumber(channels[tagChannel].vote.seen);
+  #endif
+  USART_Transmit('\r');
+  USART_Transmit('\n');
+}
+
+void printDecimal (const struct tagFields * fields) {
   #ifdef Manufacturer_ID_Output
-  int manufacturerId = getDecimalFromBinary( array + MANUFACTURER_ID_OFFSET,MANUFACTURER_ID_LENGTH);
-  manufacturerId = getDecimalFromBinary( array + MANUFACTURER_ID_OFFSET,MANUFACTURER_ID_LENGTH);
-  recurseDecimal(manufacturerId);
+  printNumber(fields->value[FIELD_MANUFACTURER]);
   #endif
-  
+
   #ifdef Split_Tags_With
     USART_Transmit(Split_Tags_With);
   #endif
-  
+
   #ifdef Site_Code_Output
-  
-  int siteCode = getDecimalFromBinary( array + SITE_CODE_OFFSET,SITE_CODE_LENGTH);
-  recurseDecimal(siteCode);
+  printNumber(fields->value[FIELD_SITE]);
   #endif
 
   #ifdef Split_Tags_With
@@ -248,29 +720,40 @@ void printDecimal (int array[45]) {
   #endif
 
   #ifdef Unique_Id_Output
-  int lastId = getDecimalFromBinary( array + UNIQUE_ID_OFFSET,UNIQUE_ID_LENGTH);
-  recurseDecimal(lastId);
+  printNumber(fields->value[FIELD_UNIQUE]);
   #endif
-  
-  USART_Transmit('\r');
-  USART_Transmit('\n');
+  printLineEnd();
 }
-void printHexadecimal (int array[45]) {
-  int i;
-  #ifdef Manufacturer_ID_Output
-  for (i = MANUFACTURER_ID_OFFSET; i < MANUFACTURER_ID_OFFSET+MANUFACTURER_ID_LENGTH; i+=4) {
-    USART_Transmit(binaryTohex(array[i],array[i+1],array[i+2],array[i+3]));
+
+/********************************* PRINT FIELD ********************************\
+| Send one field of a tag in hex, as many digits as its length needs, or in   |
+| binary, one digit for each of its bits                                       |
+\******************************************************************************/
+void printHexField (const struct tagFields * fields, unsigned char field) {
+  unsigned char i;
+  for (i = (fields->length[field] + 3) & ~0x03; i > 0; i -= 4) {
+    USART_Transmit(hexDigit(fields->value[field] >> (i - 4)));
+  }
+}
+
+void printBinaryField (const struct tagFields * fields, unsigned char field) {
+  unsigned char i;
+  for (i = fields->length[field]; i > 0; i--) {
+    USART_Transmit('0' + ((fields->value[field] >> (i - 1)) & 0x01));
   }
+}
+
+void printHexadecimal (const struct tagFields * fields) {
+  #ifdef Manufacturer_ID_Output
+  printHexField(fields, FIELD_MANUFACTURER);
   #endif
-  
+
   #ifdef Split_Tags_With
     USART_Transmit(Split_Tags_With);
   #endif
-  
+
   #ifdef Site_Code_Output
-  for (i = SITE_CODE_OFFSET; i < SITE_CODE_OFFSET+SITE_CODE_LENGTH; i+=4) {
-    USART_Transmit(binaryTohex(array[i],array[i+1],array[i+2],array[i+3]));
-  }
+  printHexField(fields, FIELD_SITE);
   #endif
 
   #ifdef Split_Tags_With
@@ -278,32 +761,22 @@ void printHexadecimal (int array[45]) {
   #endif
 
   #ifdef Unique_Id_Output
-  for (i = UNIQUE_ID_OFFSET; i < UNIQUE_ID_OFFSET+UNIQUE_ID_LENGTH; i+=4) {
-    USART_Transmit(binaryTohex(array[i],array[i+1],array[i+2],array[i+3]));
-  }
+  printHexField(fields, FIELD_UNIQUE);
   #endif
-  USART_Transmit('\r');
-  USART_Transmit('\n');
+  printLineEnd();
 }
 
-
-
-void printBinary (int array[45]) {
-  int i;
+void printBinary (const struct tagFields * fields) {
   #ifdef Manufacturer_ID_Output
-  for (i = MANUFACTURER_ID_OFFSET; i < MANUFACTURER_ID_OFFSET+MANUFACTURER_ID_LENGTH; i++) {
-    USART_Transmit('0'+array[i]);
-  }
+  printBinaryField(fields, FIELD_MANUFACTURER);
   #endif
-  
+
   #ifdef Split_Tags_With
     USART_Transmit(Split_Tags_With);
   #endif
-  
+
   #ifdef Site_Code_Output
-  for (i = SITE_CODE_OFFSET; i < SITE_CODE_OFFSET+SITE_CODE_LENGTH; i++) {
-    USART_Transmit('0'+array[i]);
-  }
+  printBinaryField(fields, FIELD_SITE);
   #endif
 
   #ifdef Split_Tags_With
@@ -311,312 +784,1234 @@ void printBinary (int array[45]) {
   #endif
 
   #ifdef Unique_Id_Output
-  for (i = UNIQUE_ID_OFFSET; i < UNIQUE_ID_OFFSET+UNIQUE_ID_LENGTH; i++) {
-    USART_Transmit('0'+array[i]);
-  }
+  printBinaryField(fields, FIELD_UNIQUE);
   #endif
-  USART_Transmit('\r');
-  USART_Transmit('\n');
+  printLineEnd();
 }
 
 
 
 
-/********************************* Search Tag *********************************\
-| This function searches for a tag in the list of tags stored in the flash     |
-| memory, if the tag is found then the function returns 1 (true) if the tag    |
-| is not found then the function returns 0 (false)                             |
+  //////////////////////////////////////////////////////////////////////////////
+ ///////////////////////////////////// DOOR ///////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+/************************************ DOOR ************************************\
+| The door, its leds and the button are run by the scheduler so tags keep     |
+| being read while the door is open                                            |
+|   DOOR_CLOSED  the servo is idle                                             |
+|   DOOR_OPEN    the servo is open and the green led is on. The button is     |
+|                checked every BUTTON_POLL_MS, pressing it (PB7 low for two   |
+|                checks in a row) or DOOR_OPEN_MS passing closes the door.    |
+|                Another good tag keeps it open for DOOR_OPEN_MS more         |
+|   DOOR_CLOSING the servo is closing, after SERVO_MOVE_MS it goes idle       |
 \******************************************************************************/
-int searchTag (int tag) {
-  int i;
-  for (i = 0; i < namesize; i++) {
-    if (tag == names[i]) {
-      return 1;
-    }
-  }
-  return 0;
+#define DOOR_CLOSED  0
+#define DOOR_OPEN    1
+#define DOOR_CLOSING 2
+unsigned char doorState;  // DOOR_CLOSED, DOOR_OPEN or DOOR_CLOSING
+unsigned char buttonDown; // the button was down at the last check
+
+void doorIdle (void) {
+  servoPosition(0);
+  doorState = DOOR_CLOSED;
 }
 
+void doorClose (void) {
+  schedCancel(doorClose);
+  PORTB &= ~0x04;
+  servoPosition(SERVO_CLOSE);
+  doorState = DOOR_CLOSING;
+  schedAfter(doorIdle, SERVO_MOVE_MS);
+}
 
+void buttonPoll (void) {
+  if (doorState != DOOR_OPEN) {
+    return;
+  }
+  if (!(PINB & (1<<7))) {
+    if (buttonDown) {
+      doorClose();
+      return;
+    }
+    buttonDown = 1;
+  }
+  else {
+    buttonDown = 0;
+  }
+  schedAfter(buttonPoll, BUTTON_POLL_MS);
+}
 
+void deniedLedOff (void) {
+  PORTB &= ~0x08;
+}
 
 void whiteListSuccess () {
   PORTB |= 0x04;
-  // open the door
-  OCR1A = 10000 - SERVO_OPEN;
-  {
-    unsigned long i;
-    for (i = 0; i < 2500000; i++) {
-      if (!((PINB & (1<<7))>>7)) {
-        break;
-      }
-    }
-  }
-  //close the door
-  OCR1A = 10000 - SERVO_CLOSE;
-  {
-    unsigned long i;
-    for (i = 0; i < 500000; i++) {
-      asm volatile ("nop");
-    }
-  }
-  OCR1A = 0;
-  wait (5000);
+  // open the door, or keep it open longer if it already is
+  schedCancel(doorIdle);
+  servoPosition(SERVO_OPEN);
+  doorState = DOOR_OPEN;
+  buttonDown = 0;
+  schedAfter(doorClose, DOOR_OPEN_MS);
+  schedAfter(buttonPoll, BUTTON_POLL_MS);
 }
 void whiteListFailure () {
   PORTB |= 0x08;
-  wait (5000);
+  schedAfter(deniedLedOff, DENIED_LED_MS);
 }
 
 
 
+/********************************** PRINT TAG *********************************\
+| Sends the whole 44 bit tag as 11 hex digits, no matter which parts are set  |
+| to be output when a tag is read                                              |
+\******************************************************************************/
+void printTag (const unsigned char frame[FRAME_BYTES]) {
+  unsigned char i;
+  for (i = 0; i < 44; i += 4) {
+    USART_Transmit(hexDigit(getFrameField(frame, i, 4)));
+  }
+  USART_Transmit('\r');
+  USART_Transmit('\n');
+}
+
   //////////////////////////////////////////////////////////////////////////////
- ///////////////////////////// ANALYSIS FUNCTIONS /////////////////////////////
+ /////////////////////////////// BINARY PACKETS ///////////////////////////////
 //////////////////////////////////////////////////////////////////////////////
+/********************************** PACKETS ***********************************\
+| A packet is                                                                  |
+|   PACKET_SYNC, type, the data for that type, 16 bit sequence number, CRC-8    |
+| The sequence number goes up by one for every packet so the host can tell    |
+| when one was lost, and the CRC-8 (polynomial 0x07, starting at 0) covers    |
+| everything after the sync byte. Multi byte numbers are sent high byte first |
+\******************************************************************************/
+#define PACKET_SYNC 0xA5 // first byte of every packet
+#define PACKET_TAG  0x01 // data is the 6 bytes of a tag that has arrived and
+                         // the 16 bit schedNow() it was sent at
+#define PACKET_REMOVED 0x02 // the same for a tag that has left
+
+unsigned int packetSequence; // sequence number of the next packet
+unsigned char packetCrc;     // CRC of the packet being sent
+volatile char packetOpen;    // a packet is being queued, a raw packet waits
 
-/************************* CONVERT RAW DATA TO BINARY *************************\
-| Converts the raw 'pulse per wave' count (5,6,or 7) to binary data (0, or 1)  |
+void packetByte (unsigned char value) {
+  packetCrc = _crc8_ccitt_update(packetCrc, value);
+  USART_Transmit(value);
+}
+
+void packetStart (unsigned char type) {
+  packetOpen = 1;
+  USART_LineStart();
+  USART_Transmit(PACKET_SYNC);
+  packetCrc = 0;
+  packetByte(type);
+}
+
+void packetEnd (void) {
+  packetByte(packetSequence >> 8);
+  packetByte(packetSequence & 0xFF);
+  USART_Transmit(packetCrc);
+  USART_LineEnd();
+  packetSequence++;
+  packetOpen = 0;
+}
+
+#ifdef Raw_Capture_Stream
+/********************************* RAW STREAM *********************************\
+| Sends channel 0's waves as they are captured, so a reader that will not read |
+| a card can be recorded on site and replayed through the decoder later. The   |
+| USART interrupt packs them straight out of the wave queue, or the capture    |
+| buffer, one byte at a time, so they are never copied. A raw packet is        |
+|   PACKET_SYNC, type, number of waves, the waves, 16 bit sequence, CRC-8      |
+| with its own sequence number. Each wave is a two bit code, high bits first,  |
+| 0 1 and 2 for 5 6 and 7 pulses and RAW_ESCAPE for anything else, followed    |
+| by the pulse count in four more codes. The last byte is padded with 0s. A    |
+| raw packet is only started when no text or other packet is half sent         |
 \******************************************************************************/
-void convertRawDataToBinary (char * buffer) {
-  int i;
-  for (i = 1; i < ARRAYSIZE; i++) {
-    if (buffer[i] == 5) {
-      buffer[i] = 0;
+#define PACKET_RAW 0x03     // data is a number of waves and the waves
+#define PACKET_RAW_GAP 0x04 // the same, but waves were lost before these
+#ifdef Streaming_Decoder
+#define RAW_WAVES (WAVE_QUEUE / 2) // waves in a packet, it waits for this many
+#else
+#define RAW_WAVES 128       // most waves in a packet
+#endif
+#define RAW_FIRST WAVE_ZERO // pulses of a wave sent as code 0
+#define RAW_ESCAPE 3        // code of a wave whose pulse count follows
+
+enum {
+  RAW_SYNC,                 // between packets
+  RAW_TYPE,
+  RAW_COUNT,
+  RAW_DATA,
+  RAW_SEQUENCE_HIGH,
+  RAW_SEQUENCE_LOW,
+  RAW_CRC
+};
+
+unsigned int rawSequence;   // sequence number of the next raw packet
+unsigned char rawCrc;       // CRC of the raw packet being sent
+unsigned char rawEscape;    // codes of an escaped pulse count still to be sent
+unsigned char rawPulses;    // the escaped pulse count, high bits first
+
+// Returns how many waves are waiting to be sent
+static inline unsigned char rawWaiting (void) {
+  #ifdef Streaming_Decoder
+  return (unsigned char)(channels[0].waveHead - rawTail);
+  #else
+  return rawEnd - rawNext < 255 ? rawEnd - rawNext : 255;
+  #endif
+}
+
+static inline char rawReady (void) {
+  #ifdef Streaming_Decoder
+  return rawOn && rawWaiting() >= RAW_WAVES;
+  #else
+  return rawBusy;
+  #endif
+}
+
+static inline unsigned char rawWave (void) {
+  #ifdef Streaming_Decoder
+  unsigned char pulses = channels[0].waveQueue[rawTail & (WAVE_QUEUE - 1)];
+  rawTail = rawTail + 1;
+  return pulses;
+  #else
+  return *rawNext++;
+  #endif
+}
+
+// Packs the next four codes into a byte
+static inline unsigned char rawData (void) {
+  unsigned char data = 0;
+  unsigned char i;
+  for (i = 0; i < 4; i++) {
+    unsigned char code = 0;
+    if (rawEscape) {
+      code = rawPulses >> 6;
+      rawPulses <<= 2;
+      rawEscape--;
     }
-    else if (buffer[i] == 7) {
-      buffer[i] = 1;
+    else if (rawLeft) {
+      unsigned char pulses = rawWave();
+      rawLeft--;
+      code = pulses - RAW_FIRST;
+      if (code >= RAW_ESCAPE) {
+        code = RAW_ESCAPE;
+        rawPulses = pulses;
+        rawEscape = 4;
+      }
     }
-    else if (buffer[i] == 6) {
-       buffer[i] = buffer[i-1];
+    data = (data << 2) | code;
+  }
+  return data;
+}
+
+static inline unsigned char rawByte (void) {
+  unsigned char value;
+  switch (rawState) {
+    case RAW_SYNC:
+      rawCrc = 0;
+      rawState = RAW_TYPE;
+      return PACKET_SYNC;
+    case RAW_TYPE:
+      #ifdef Streaming_Decoder
+      if (rawSkip) {
+        rawTail = rawHole;
+        rawSkip = 0;
+      }
+      #endif
+      value = rawGap ? PACKET_RAW_GAP : PACKET_RAW;
+      rawGap = 0;
+      rawState = RAW_COUNT;
+      break;
+    case RAW_COUNT:
+      value = rawWaiting() < RAW_WAVES ? rawWaiting() : RAW_WAVES;
+      rawLeft = value;
+      rawState = value ? RAW_DATA : RAW_SEQUENCE_HIGH;
+      break;
+    case RAW_DATA:
+      value = rawData();
+      if (!rawLeft && !rawEscape) {
+        rawState = RAW_SEQUENCE_HIGH;
+      }
+      break;
+    case RAW_SEQUENCE_HIGH:
+      value = rawSequence >> 8;
+      rawState = RAW_SEQUENCE_LOW;
+      break;
+    case RAW_SEQUENCE_LOW:
+      value = rawSequence & 0xFF;
+      rawSequence++;
+      rawState = RAW_CRC;
+      break;
+    default:
+      #ifndef Streaming_Decoder
+      if (rawNext == rawEnd) {
+        rawBusy = 0;
+      }
+      #endif
+      rawState = RAW_SYNC;
+      return rawCrc;
+  }
+  rawCrc = _crc8_ccitt_update(rawCrc, value);
+  return value;
+}
+
+// Called by the USART interrupt, sends the next byte of a raw packet and
+// returns 1, or returns 0 if the queue should be sent instead
+static inline char rawSend (char queueEmpty) {
+  if (rawState == RAW_SYNC && !(queueEmpty && !packetOpen && rawReady())) {
+    return 0;
+  }
+  UCSR0A |= (1<<TXC0);
+  txSent = 1;
+  UDR0 = rawByte();
+  return 1;
+}
+
+// Called from the main loop, starts the USART interrupt once a packet's worth
+// of waves is waiting. It turns itself off whenever it has nothing to send
+void rawPoll (void) {
+  if (rawReady()) {
+    UCSR0B |= (1<<UDRIE0);
+  }
+}
+
+#ifndef Streaming_Decoder
+// Sends a full capture buffer, if the raw stream is on. The main loop keeps
+// the buffer from the interrupt until rawBusy is 0
+void rawBuffer (const char * buffer) {
+  if (rawOn) {
+    rawNext = buffer;
+    rawEnd = buffer + ARRAYSIZE;
+    rawBusy = 1;
+  }
+}
+#endif
+
+/********************************* RAW COMMAND ********************************\
+| D turns the raw stream on or off. It starts from the newest wave, so the     |
+| first packet has no gap                                                      |
+\******************************************************************************/
+void rawCommand (void) {
+  if (rawOn) {
+    rawOn = 0;
+    USART_Print(PSTR("RAW OFF\r\n"));
+    return;
+  }
+  USART_Print(PSTR("RAW ON\r\n"));
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    #ifdef Streaming_Decoder
+    rawTail = channels[0].waveHead;
+    rawSkip = 0;
+    #endif
+    rawGap = 0;
+    rawOn = 1;
+  }
+}
+#endif
+
+/********************************* SEND FRAME *********************************\
+| Sends a tag as a PACKET_TAG or PACKET_REMOVED packet, 13 bytes like          |
+| printHexadecimal instead of the 46 of printBinary. The 44 bits of the tag    |
+| are sent high bit first and the last four bits of the sixth byte are the     |
+| channel that read it, always 0 without Second_Channel. Then comes the        |
+| millisecond tick, so the host can tell when the tag came and went even if    |
+| the packets sat in a buffer. It wraps every 65.5 seconds                     |
+\******************************************************************************/
+void sendFrame (unsigned char type, unsigned char channel, const unsigned char frame[FRAME_BYTES]) {
+  unsigned int now = schedNow();
+  unsigned char i;
+  packetStart(type);
+  for (i = 0; i < FRAME_BYTES - 1; i++) {
+    packetByte(frame[i]);
+  }
+  packetByte((frame[FRAME_BYTES - 1] & 0xF0) | channel);
+  packetByte(now >> 8);
+  packetByte(now & 0xFF);
+  packetEnd();
+}
+
+/******************************** PRINT CHANNEL *******************************\
+| With Second_Channel each line of text about a tag starts with the number of  |
+| the channel that read it and a space                                         |
+\******************************************************************************/
+void printChannel (unsigned char channel) {
+  #ifdef Second_Channel
+  USART_Transmit('0' + channel);
+  USART_Transmit(' ');
+  #endif
+}
+
+/********************************* Report Tag *********************************\
+| Sends a successfully decoded tag out over serial in the selected formats and |
+| runs it against the whitelist if the whitelist is enabled. The fields are    |
+| read once, from where the tag's card format keeps them. Tags from every      |
+| channel come through here, each line is marked with its channel              |
+\******************************************************************************/
+void reportTag (unsigned char channel, const unsigned char frame[FRAME_BYTES]) {
+  struct tagFields fields;
+  frameFields (frame, &fields);
+  tagChannel = channel;
+
+  #ifdef Binary_Tag_Output         // Outputs the Read tag in binary over serial
+    USART_LineStart();
+    printChannel (channel);
+    printBinary (&fields);
+    USART_LineEnd();
+  #endif
+    
+  #ifdef Hexadecimal_Tag_Output    // Outputs the read tag in Hexadecimal over serial
+    USART_LineStart();
+    printChannel (channel);
+    printHexadecimal (&fields);
+    USART_LineEnd();
+  #endif
+    
+  #ifdef Decimal_Tag_Output
+    USART_LineStart();
+    printChannel (channel);
+    printDecimal (&fields);
+    USART_LineEnd();
+  #endif
+  
+  #ifdef Binary_Frame_Output
+    sendFrame (PACKET_TAG, channel, frame);
+  #endif
+  
+  #ifdef Whitelist_Enabled
+  if (searchTag(frame)) {
+    #ifdef EVENTS_ENABLED
+    eventLog(frame, 1);
+    #endif
+    whiteListSuccess ();
+  }
+  else {
+    #ifdef EVENTS_ENABLED
+    eventLog(frame, 0);
+    #endif
+    whiteListFailure();
+  }
+  #endif
+}
+
+
+
+/******************************* Report Removed *******************************\
+| Sends that a tag which was reported has left the reader                      |
+\******************************************************************************/
+void reportRemoved (unsigned char channel, const unsigned char frame[FRAME_BYTES]) {
+  #ifdef Removed_Events
+    #ifdef Binary_Frame_Output
+    sendFrame (PACKET_REMOVED, channel, frame);
+    #else
+    USART_LineStart();
+    USART_Print(PSTR("REMOVED "));
+    printChannel (channel);
+    printTag (frame);
+    USART_LineEnd();
+    #endif
+  #endif
+}
+
+/******************************** Frame Found *********************************\
+| Called with every frame a channel decodes. The frame is voted on and once    |
+| VOTES_NEEDED frames with good parity agree the tag is looked up in the tag  |
+| cache. It is only reported, and checked against the whitelist, if it was    |
+| not already at that channel's antenna, a card that is held there is not      |
+| reported again on every frame. If a channel has no frame for                 |
+| VOTE_TIMEOUT_MS its vote starts over                                         |
+\******************************************************************************/
+void voteExpire (void) {
+  unsigned int now = schedNow();
+  unsigned int wait = 0;
+  unsigned char c;
+  for (c = 0; c < CHANNELS; c++) {
+    unsigned int idle = now - channels[c].lastFrame;
+    if (idle >= VOTE_TIMEOUT_MS) {
+      voteReset(&channels[c].vote);
     }
-    else {
-      buffer[i] = -2;
+    else if (channels[c].vote.seen && VOTE_TIMEOUT_MS - idle > wait) {
+      wait = VOTE_TIMEOUT_MS - idle;
     }
   }
+  if (wait) {
+    schedAfter(voteExpire, wait);
+  }
 }
 
-/******************************* FIND START TAG *******************************\
-| This function goes through the buffer and tries to find a group of fifteen   |
-| or more 1's in a row. This sigifies the start tag. If you took the fifteen   |
-| ones in multibit they would come out to be '111' in single-bit               |
+#ifdef STATS_ENABLED
+/****************************** STATS PRESENCE ********************************\
+| Times how long a card is at the reader before its first frame with good     |
+| parity. statsArrival runs after each batch of waves, the first start tag    |
+| after none for VOTE_TIMEOUT_MS is a card arriving. statsFirstFrame stops    |
+| the timing at the card's first good frame                                   |
 \******************************************************************************/
-int findStartTag (char * buffer) {
-  int i;
-  int inARow = 0;
-  int lastVal = 0;
-  for (i = 0; i < ARRAYSIZE; i++) {
-    if (buffer [i] == lastVal) {
-      inARow++;
+#define PRESENT_AWAY     0 // no card, or its time has been counted
+#define PRESENT_ARRIVING 1 // a card arrived and has no good frame yet
+unsigned char presentState;  // PRESENT_AWAY or PRESENT_ARRIVING
+unsigned long presentTags;   // stats.startTags at the last check
+unsigned int presentSince;   // schedNow() at the card's first start tag
+unsigned int presentLastTag; // schedNow() at the last start tag
+
+void statsArrival (void) {
+  unsigned int now;
+  if (stats.startTags == presentTags) {
+    return;
+  }
+  presentTags = stats.startTags;
+  now = schedNow();
+  if ((unsigned int)(now - presentLastTag) > VOTE_TIMEOUT_MS) {
+    presentState = PRESENT_ARRIVING;
+    presentSince = now;
+  }
+  presentLastTag = now;
+}
+
+void statsFirstFrame (const unsigned char frame[FRAME_BYTES]) {
+  if (presentState == PRESENT_ARRIVING && frameParity(frame)) {
+    stats.presentLast = schedNow() - presentSince;
+    if (stats.presentLast > stats.presentMax) {
+      stats.presentMax = stats.presentLast;
     }
-    else {
-      // End of the group of bits with the same value
-      if (inARow >= 15 && lastVal == 1) {
-        // Start tag found
-        break;
+    presentState = PRESENT_AWAY;
+  }
+}
+
+// Timer0 counts from the start of main until it turned on the capture
+// interrupt, how long the reader is blind after a reset
+unsigned int readyClock;
+#endif
+
+void channelFrame (unsigned char channel, const unsigned char frame[FRAME_BYTES]) {
+  struct channel * c = &channels[channel];
+  STAT_STAGE(STAT_VOTE);
+  PORTB &= ~0x10;
+  c->lastFrame = schedNow();
+  schedAfter(voteExpire, VOTE_TIMEOUT_MS);
+  #ifdef STATS_ENABLED
+  statsFirstFrame(frame);
+  #endif
+  #ifdef Low_Power_Idle
+  idleSince = c->lastFrame;
+  idleAfter = IDLE_TIMEOUT_MS;
+  #endif
+  if (voteFrame(&c->vote, frame) && cacheSeen(channel, c->vote.frame)) {
+    #ifdef Low_Power_Idle
+    powerRead();
+    #endif
+    STAT_STAGE(STAT_REPORT);
+    reportTag (channel, c->vote.frame);
+  }
+  // back to the decoder, which has finished the frame and looks for the
+  // next start tag
+  STAT_STAGE(STAT_SEARCH);
+}
+
+// the buffered decoder only reads channel 0
+void frameFound (const unsigned char frame[FRAME_BYTES]) {
+  channelFrame(0, frame);
+}
+
+#ifdef Streaming_Decoder
+/******************************** DECODE QUEUED *******************************\
+| Runs decodeWave over the waves each channel has queued. From the main loop  |
+| every frame is voted on as it is found. While a command waits to send its   |
+| reply nothing else can be sent, so the first frame of each channel is held  |
+| for the main loop and the ones after it are only decoded, which keeps the   |
+| decoder in step with the card                                               |
+\******************************************************************************/
+void decodeQueued (char replying) {
+  unsigned char c;
+  unsigned char i;
+  for (c = 0; c < CHANNELS; c++) {
+    struct channel * channel = &channels[c];
+    if (channel->holding && !replying) {
+      channel->holding = 0;
+      channelFrame(c, channel->held);
+    }
+    if (channel->waveTail != channel->waveHead) {
+      STAT_STAGE(channel->reader.state == STREAM_READING ? STAT_DECODE : STAT_SEARCH);
+      while (channel->waveTail != channel->waveHead) {
+        if (decodeWave(&channel->reader, channel->waveQueue[channel->waveTail & (WAVE_QUEUE - 1)])) {
+          if (!replying) {
+            channelFrame (c, channel->reader.frame);
+          }
+          else if (!channel->holding) {
+            for (i = 0; i < FRAME_BYTES; i++) {
+              channel->held[i] = channel->reader.frame[i];
+            }
+            channel->holding = 1;
+          }
+        }
+        channel->waveTail = channel->waveTail + 1;
       }
-      // group of bits was not a start tag, search next tag
-      inARow = 1;
-      lastVal = buffer[i];
+      STAT_STAGE(STAT_IDLE);
+      #ifdef STATS_ENABLED
+      statsArrival();
+      #endif
     }
   }
-  return i;
 }
+#endif
 
-/************************ PARSE MULTIBIT TO SINGLE BIT ************************\
-| This function takes in the start tag and starts parsing the multi-bit code   |
-| to produce the single bit result in the outputBuffer array the resulting     |
-| code is single bit manchester code                                           |
+/******************************** Tags Removed ********************************\
+| Runs every CACHE_POLL_MS and reports the tags that have not been read for    |
+| CACHE_HOLD_MS                                                                |
 \******************************************************************************/
-void parseMultiBitToSingleBit (char * buffer, int startOffset, int outputBuffer[]) {
-  int i = startOffset; // the offset value of the start tag
-  int lastVal = 0; // what was the value of the last bit
-  int inARow = 0; // how many identical bits are in a row// this may need to be 1 but seems to work fine
-  int resultArray_index = 0;
-  for (;i < ARRAYSIZE; i++) {
-    if (buffer [i] == lastVal) {
-      inARow++;
-    }
-    else {
-      // End of the group of bits with the same value
-      if (inARow >= 4 && inARow <= 8) {
-        // there are between 4 and 8 bits of the same value in a row
-        // Add one bit to the resulting array
-        outputBuffer[resultArray_index] = lastVal;
-        resultArray_index += 1;
+void tagsRemoved (void) {
+  unsigned char frame[FRAME_BYTES];
+  unsigned char channel;
+  while (cacheRemoved(frame, &channel)) {
+    reportRemoved(channel, frame);
+  }
+  schedAfter(tagsRemoved, CACHE_POLL_MS);
+}
+
+/******************************* Analize Input *******************************\
+| analizeInput(char*) runs decodeBuffer over a full capture buffer, every     |
+| frame in it is voted on. The decoder and the vote carry on into the next    |
+| buffer, so a frame can start in one buffer and end in the next              |
+\*****************************************************************************/
+void analizeInput (char * buffer) {
+  decodeBuffer(&channels[0].reader, buffer, frameFound);
+}
+
+#ifdef Serial_Commands
+  //////////////////////////////////////////////////////////////////////////////
+ /////////////////////////////// SERIAL COMMANDS //////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+#define COMMAND_LENGTH 20 // longest command line that is read
+char commandLine[COMMAND_LENGTH];
+unsigned char commandLength; // characters in commandLine, COMMAND_LENGTH if
+                             // the line was too long and is thrown away
+
+/********************************** PARSE TAG *********************************\
+| Reads a tag written as the 11 hex digits printTag sends into frame. Returns  |
+| 0 if the text is not a tag                                                   |
+\******************************************************************************/
+char parseTag (const char * text, unsigned char frame[FRAME_BYTES]) {
+  unsigned char i;
+  while (*text == ' ') {
+    text++;
+  }
+  for (i = 0; i < FRAME_BYTES; i++) {
+    frame[i] = 0;
+  }
+  for (i = 0; i < 11; i++) {
+    char c = text[i];
+    unsigned char value;
+    if (c >= '0' && c <= '9') value = c - '0';
+    else if (c >= 'A' && c <= 'F') value = c - 'A' + 10;
+    else if (c >= 'a' && c <= 'f') value = c - 'a' + 10;
+    else return 0;
+    frame[i >> 1] |= (i & 0x01) ? value : value << 4;
+  }
+  text += 11;
+  while (*text == ' ') {
+    text++;
+  }
+  return *text == '\0';
+}
+
+void printStoreResult (char result) {
+  switch (result) {
+    case STORE_OK:        USART_Print(PSTR("OK\r\n"));        break;
+    case STORE_FULL:      USART_Print(PSTR("FULL\r\n"));      break;
+    case STORE_BUSY:      USART_Print(PSTR("BUSY\r\n"));      break;
+    case STORE_EXISTS:    USART_Print(PSTR("EXISTS\r\n"));    break;
+    case STORE_NOT_FOUND: USART_Print(PSTR("NOT FOUND\r\n")); break;
+  }
+}
+
+/*************************** PRINT SERIAL COUNTERS ****************************\
+| Sends how many characters were thrown away because the transmit or receive  |
+| queue was full, and how many tags that were read were already at the reader |
+| (hits) or had just arrived (misses)                                          |
+\******************************************************************************/
+void printSerialCounters (void) {
+  unsigned int dropped;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    dropped = rxDropped;
+  }
+  USART_Wait(40);
+  USART_Print(PSTR("TX DROPPED "));
+  printNumber(txDropped);
+  USART_Print(PSTR(" IN "));
+  printNumber(txOverflows);
+  USART_Print(PSTR("\r\nRX DROPPED "));
+  printNumber(dropped);
+  USART_Print(PSTR("\r\n"));
+  USART_Wait(40);
+  USART_Print(PSTR("CACHE HITS "));
+  printNumber(cacheHits);
+  USART_Print(PSTR(" MISSES "));
+  printNumber(cacheMisses);
+  USART_Print(PSTR("\r\n"));
+}
+
+// Sends the name, from flash, and the value of a counter
+void printCounter (const char * name, unsigned long value) {
+  USART_Wait(32);
+  USART_Print(name);
+  printNumber(value);
+}
+
+#ifdef STATS_ENABLED
+/********************************* PRINT STATS ********************************\
+| Sends the counters in stats.h, a few to a line. They are copied with        |
+| interrupts off so the ones the interrupts count are not read half updated   |
+\******************************************************************************/
+void printStats (void) {
+  struct stats now;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    now = stats;
+  }
+  printCounter(PSTR("EDGES "), now.edges);
+  printCounter(PSTR(" WAVES "), now.waves);
+  printCounter(PSTR(" OVERRUNS "), now.overruns);
+  printCounter(PSTR("\r\nSTART TAGS "), now.startTags);
+  printCounter(PSTR(" NO START TAG "), now.noStartTag);
+  printCounter(PSTR("\r\nBAD WAVES "), now.badWaves);
+  printCounter(PSTR(" NOT MANCHESTER "), now.badManchester);
+  printCounter(PSTR(" SHORT "), now.shortFrames);
+  printCounter(PSTR("\r\nFRAMES "), now.frames);
+  printCounter(PSTR(" BAD PARITY "), now.badParity);
+  printCounter(PSTR("\r\nSEARCH "), now.stageTime[STAT_SEARCH]);
+  printCounter(PSTR(" DECODE "), now.stageTime[STAT_DECODE]);
+  printCounter(PSTR("\r\nVOTE "), now.stageTime[STAT_VOTE]);
+  printCounter(PSTR(" REPORT "), now.stageTime[STAT_REPORT]);
+  printCounter(PSTR("\r\nPRESENT MS "), now.presentLast);
+  printCounter(PSTR(" MAX "), now.presentMax);
+  printCounter(PSTR("\r\nREADY "), readyClock);
+  USART_Print(PSTR("\r\n"));
+}
+#endif
+
+/****************************** PRINT CALIBRATION *****************************\
+| Sends where the decoder's thresholds are, the pulses in a 0 and a 1 wave and |
+| the waves in a bit of 0s and of 1s, and how many times they have moved.     |
+| They are kept in quarters and sent with two decimal places                  |
+\******************************************************************************/
+void printQuarters (const char * name, unsigned char quarters) {
+  USART_Wait(16);
+  USART_Print(name);
+  printNumber(quarters >> 2);
+  USART_Transmit('.');
+  switch (quarters & 0x03) {
+    case 0: USART_Print(PSTR("00")); break;
+    case 1: USART_Print(PSTR("25")); break;
+    case 2: USART_Print(PSTR("50")); break;
+    case 3: USART_Print(PSTR("75")); break;
+  }
+}
+
+void printCalibration (void) {
+  printQuarters(PSTR("ZERO "), calibration.zero);
+  printQuarters(PSTR(" ONE "), calibration.one);
+  printQuarters(PSTR(" BIT0 "), calibration.single[0]);
+  printQuarters(PSTR(" BIT1 "), calibration.single[1]);
+  USART_Wait(20);
+  USART_Print(PSTR("\r\nUPDATES "));
+  printNumber(calibration.updates);
+  USART_Print(PSTR("\r\n"));
+}
+
+#ifdef EVENTS_ENABLED
+/********************************* PRINT EVENTS *******************************\
+| Sends every read in the event log, oldest first, one to a line:              |
+|   EVENT <seconds> GRANTED|DENIED <tag>                                       |
+| then END and the time now, so the host can work out when each read was.      |
+| Records that are being written over as they are read are left out. E only   |
+| starts the log, eventsPoll sends a line of it from the main loop whenever   |
+| there is room for one, so cards are read and reported while it goes out     |
+\******************************************************************************/
+unsigned char eventsNext; // position of the record eventsPoll sends next
+unsigned char eventsEnd;  // eventCount() when E came, END is sent there
+unsigned char eventsOver; // eventWrittenOver when the positions were last moved
+char eventsSending;       // E has come and END has not been sent
+
+void printEvents (void) {
+  eventsNext = 0;
+  eventsEnd = eventCount();
+  eventsOver = eventWrittenOver;
+  eventsSending = 1;
+}
+
+void eventsPoll (void) {
+  unsigned char record[EVENT_RECORD_BYTES];
+  unsigned char over;
+  if (!eventsSending || USART_Room() < 40) {
+    return;
+  }
+  // each record written over moves the rest one position closer to the oldest
+  over = eventWrittenOver - eventsOver;
+  eventsOver += over;
+  eventsNext = eventsNext > over ? eventsNext - over : 0;
+  eventsEnd = eventsEnd > over ? eventsEnd - over : 0;
+  if (eventsNext >= eventsEnd) {
+    USART_Print(PSTR("END "));
+    printNumber(eventNow());
+    USART_Print(PSTR("\r\n"));
+    eventsSending = 0;
+    return;
+  }
+  if (!eventRead(eventsNext++, record)) {
+    return;
+  }
+  USART_Print(PSTR("EVENT "));
+  printNumber(((unsigned long)record[EVENT_TIME_BYTE] << 24)
+            | ((unsigned long)record[EVENT_TIME_BYTE + 1] << 16)
+            | ((unsigned int)record[EVENT_TIME_BYTE + 2] << 8)
+            | record[EVENT_TIME_BYTE + 3]);
+  if ((record[FRAME_BYTES - 1] & EVENT_RESULT_MASK) == EVENT_GRANTED) {
+    USART_Print(PSTR(" GRANTED "));
+  }
+  else {
+    USART_Print(PSTR(" DENIED "));
+  }
+  record[FRAME_BYTES - 1] &= EVENT_TAG_MASK;
+  printTag(record);
+}
+#endif
+
+#ifdef Low_Power_Idle
+/********************************* PRINT POWER ********************************\
+| Sends why the reader has woken up, the time it has spent awake and asleep, |
+| the average current that works out to and how long after waking the first  |
+| tag was read                                                                |
+\******************************************************************************/
+void printPower (void) {
+  printCounter(PSTR("WAKE PIN "), power.wakes[POWER_WAKE_ACTIVITY]);
+  printCounter(PSTR(" PROBE "), power.wakes[POWER_WAKE_PROBE]);
+  printCounter(PSTR(" SERIAL "), power.wakes[POWER_WAKE_SERIAL]);
+  printCounter(PSTR("\r\nAWAKE MS "), powerAwake());
+  printCounter(PSTR(" ASLEEP MS "), power.asleepMs);
+  printCounter(PSTR(" AVERAGE UA "), powerAverage());
+  printCounter(PSTR("\r\nWAKE TO READ MS "), power.readLast);
+  printCounter(PSTR(" MAX "), power.readMax);
+  USART_Print(PSTR("\r\n"));
+}
+#endif
+
+/********************************* RUN COMMAND ********************************\
+| Runs the command in commandLine                                              |
+|   A <tag>   add a tag to the whitelist in EEPROM                              |
+|   R <tag>   remove a tag from the whitelist in EEPROM                         |
+|   L         list the tags in EEPROM, sorted by frame bits 28 to 43           |
+|   S         show the serial, tag cache, reader and power counters             |
+|   Z         set the reader and power counters back to 0                       |
+|   C         show the decoder's calibrated thresholds                         |
+|   D         turn the raw stream on or off, with Raw_Capture_Stream           |
+|   E         list the event log, with EVENTS_ENABLED in events.h              |
+| Anything else is answered with '?'                                           |
+\******************************************************************************/
+void runCommand (void) {
+  unsigned char frame[FRAME_BYTES];
+  unsigned char i;
+  switch (commandLine[0]) {
+    case 'A':
+    case 'a':
+      if (parseTag(commandLine + 1, frame)) {
+        printStoreResult(storeAdd(frame));
+        return;
       }
-      else if (inARow >= 9 && inARow <= 14) {
-        // there are between 9 and 14 bits of the same value in a row
-        // Add two bits to the resulting array
-        outputBuffer[resultArray_index] = lastVal;
-        outputBuffer[resultArray_index+1] = lastVal;
-        resultArray_index += 2;
+      break;
+    case 'R':
+    case 'r':
+      if (parseTag(commandLine + 1, frame)) {
+        printStoreResult(storeRemove(frame));
+        return;
       }
-      else if (inARow >= 15 && lastVal == 0) {
-        // there are more then 15 identical bits in a row, and they are 0s
-        // this is an end tag
-        break;
+      break;
+    case 'L':
+    case 'l':
+      if (commandLine[1] == '\0') {
+        for (i = 0; i < storeCount(); i++) {
+          // wait for each line to fit so the list is not cut short
+          USART_Wait(13);
+          storeRead(i, frame);
+          printTag(frame);
+        }
+        USART_Wait(5);
+        USART_Print(PSTR("END\r\n"));
+        return;
       }
-      // group of bits was not the end tag, continue parsing data
-      inARow = 1;
-      lastVal = buffer[i];
-      if (resultArray_index >= 90) {
-        //return;
+      break;
+    case 'S':
+    case 's':
+      if (commandLine[1] == '\0') {
+        printSerialCounters();
+        printCounter(PSTR("SCHED FULL "), schedFull);
+        USART_Print(PSTR("\r\n"));
+        #ifdef STATS_ENABLED
+        printStats();
+        #endif
+        #ifdef Low_Power_Idle
+        printPower();
+        #endif
+        #ifdef EVENTS_ENABLED
+        printCounter(PSTR("EVENTS "), eventCount());
+        printCounter(PSTR(" DROPPED "), eventDropped);
+        USART_Print(PSTR("\r\n"));
+        #endif
+        return;
       }
-    }
+      break;
+    #ifdef STATS_ENABLED
+    case 'Z':
+    case 'z':
+      if (commandLine[1] == '\0') {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+          statsReset();
+        }
+        #ifdef Low_Power_Idle
+        powerReset();
+        #endif
+        USART_Print(PSTR("OK\r\n"));
+        return;
+      }
+      break;
+    #endif
+    case 'C':
+    case 'c':
+      if (commandLine[1] == '\0') {
+        printCalibration();
+        return;
+      }
+      break;
+    #ifdef Raw_Capture_Stream
+    case 'D':
+    case 'd':
+      if (commandLine[1] == '\0') {
+        rawCommand();
+        return;
+      }
+      break;
+    #endif
+    #ifdef EVENTS_ENABLED
+    case 'E':
+    case 'e':
+      if (commandLine[1] == '\0') {
+        printEvents();
+        return;
+      }
+      break;
+    #endif
   }
+  USART_Print(PSTR("?\r\n"));
 }
 
-/******************************* Analize Input *******************************\
-| analizeInput(void) parses through the global variable and gets the 45 bit   |
-| id tag.                                                                     |
-| 1) Converts raw pulse per wave count (5,6,7) to binary data (0,1)           |
-| 2) Finds a start tag in the code                                            |
-| 3) Parses the data from multibit code (11111000000000000111111111100000) to |
-|     singlebit manchester code (100110) untill it finds an end tag           |
-| 4) Converts manchester code (100110) to binary code (010)                   |
-\*****************************************************************************/
-void analizeInput (void) {
-  int i;                // Generic for loop 'i' counter
-  int resultArray[90];  // Parsed Bit code in manchester
-  int finalArray[45];   //Parsed Bit Code out of manchester
-  int finalArray_index = 0;
-  
-  // Initilize the arrays so that any errors or unchanged values show up as 2s
-  for (i = 0; i < 90; i ++) { resultArray[i] = 2; }
-  for (i = 0; i < 45; i++)  { finalArray[i] = 2;  }
-  
-  // Convert raw data to binary
-  convertRawDataToBinary (begin);
-    
-  // Find Start Tag
-  int startOffset = findStartTag(begin);
-  PORTB |= 0x10; // turn an led on on pin B5)
-  
-  // Parse multibit data to single bit data
-  parseMultiBitToSingleBit(begin, startOffset, resultArray);
-  
-  // Error checking, see if there are any unset elements of the array
-  for (i = 0; i < 88; i++) { // ignore the parody bit ([88] and [89])
-    if (resultArray[i] == 2) {
-      return;
-    }
+/********************************* SERIAL POLL ********************************\
+| Called from the main loop, collects the received bytes into commandLine and |
+| runs the command at the end of each line. While the event log is going out  |
+| it sends the next line of it instead                                        |
+\******************************************************************************/
+void serialPoll (void) {
+  #ifdef EVENTS_ENABLED
+  // the next command is answered once the whole log has been sent
+  eventsPoll();
+  if (eventsSending) {
+    return;
   }
-  //------------------------------------------
-  // MANCHESTER DECODING
-  //------------------------------------------
-  for (i = 0; i < 88; i+=2) { // ignore the parody bit ([88][89])
-    if (resultArray[i] == 1 && resultArray[i+1] == 0) {
-      finalArray[finalArray_index] = 1;
+  #endif
+  while (rxTail != rxHead) {
+    char input = rxQueue[rxTail & (RX_QUEUE - 1)];
+    rxTail = rxTail + 1;
+    if (input == '\r' || input == '\n') {
+      if (commandLength == COMMAND_LENGTH) {
+        USART_Print(PSTR("?\r\n"));
+      }
+      else if (commandLength > 0) {
+        commandLine[commandLength] = '\0';
+        runCommand();
+      }
+      commandLength = 0;
     }
-    else if (resultArray[i] == 0 && resultArray[i+1] == 1) {
-      finalArray[finalArray_index] = 0;
+    else if (commandLength < COMMAND_LENGTH - 1) {
+      commandLine[commandLength] = input;
+      commandLength++;
     }
     else {
-      // The read code is not in manchester, ignore this read tag and try again
-      // free the allocated memory and end the function
-      return;
+      commandLength = COMMAND_LENGTH;
     }
-    finalArray_index++;
   }
-  
-  #ifdef Binary_Tag_Output         // Outputs the Read tag in binary over serial
-    printBinary (finalArray);
+}
+#endif
+
+#ifdef Low_Power_Idle
+  //////////////////////////////////////////////////////////////////////////////
+ ////////////////////////////////// LOW POWER /////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+/******************************** CAPTURE STOP ********************************\
+| Turns the capture interrupt off for sleeping and back on after waking. The  |
+| wave that was being counted is thrown away and the decoder starts over      |
+\******************************************************************************/
+void captureStop (void) {
+  #ifndef Input_Capture_Demod
+  EIMSK &= ~(1 << INT0);
+  #else
+  TIMSK1 &= ~(1 << ICIE1);
   #endif
-    
-  #ifdef Hexadecimal_Tag_Output    // Outputs the read tag in Hexadecimal over serial
-    printHexadecimal (finalArray);
+  #ifdef Second_Channel
+  PCICR &= ~(1 << PCIE1);
   #endif
-    
-  #ifdef Decimal_Tag_Output
-    printDecimal (finalArray);
+}
+
+void captureStart (void) {
+  #ifdef Streaming_Decoder
+  unsigned char c;
   #endif
-  
-  
-  #ifdef Whitelist_Enabled
-  if (searchTag(getDecimalFromBinary(finalArray+UNIQUE_ID_OFFSET,UNIQUE_ID_LENGTH))){
-    whiteListSuccess ();
+  #ifndef Input_Capture_Demod
+  count = 0;
+  EIFR = (1 << INTF0);
+  EIMSK |= (1 << INT0);
+  #else
+  channels[0].lastCapture = ICR1;
+  TIFR1 = (1 << ICF1);
+  TIMSK1 |= (1 << ICIE1);
+  #endif
+  #ifdef Second_Channel
+  channels[1].lastCapture = TCNT1;
+  PCIFR = (1 << PCIF1);
+  PCICR |= (1 << PCIE1);
+  #endif
+  #ifdef Streaming_Decoder
+  for (c = 0; c < CHANNELS; c++) {
+    channels[c].waveTail = channels[c].waveHead;
+    decoderReset(&channels[c].reader);
   }
-  else {
-    whiteListFailure();
+  #endif
+}
+
+/******************************** READER QUIET ********************************\
+| Returns 1 if nothing would be cut short by sleeping: the door is closed and  |
+| its servo idle, the red led is off, every tag has been reported removed,    |
+| the EEPROM is not being written and the serial port is not in the middle  |
+| of anything                                                                  |
+\******************************************************************************/
+char readerQuiet (void) {
+  char quiet = doorState == DOOR_CLOSED && !schedPending(deniedLedOff)
+            && cacheCount() == 0 && storeIdle() && USART_Idle();
+  #ifdef EVENTS_ENABLED
+  quiet = quiet && eventIdle();
+  #endif
+  #ifdef Serial_Commands
+  quiet = quiet && commandLength == 0 && rxTail == rxHead;
+  #endif
+  return quiet;
+}
+
+/******************************** READER SLEEP ********************************\
+| Runs at least every IDLE_TIMEOUT_MS. When no frame has been found for        |
+| idleAfter ms and the reader is quiet it sleeps until something wakes it.   |
+| After a DEMOD_OUT change or a probe it listens for PROBE_LISTEN_MS and goes |
+| back to sleep if there is no card. A frame, or a serial byte, keeps it awake |
+| for IDLE_TIMEOUT_MS                                                          |
+\******************************************************************************/
+void readerSleep (void) {
+  unsigned int idle = schedNow() - idleSince;
+  powerTally();
+  if (idle < idleAfter) {
+    schedAfter(readerSleep, idleAfter - idle);
+    return;
+  }
+  if (!readerQuiet()) {
+    schedAfter(readerSleep, CACHE_POLL_MS);
+    return;
+  }
+  captureStop();
+  PORTB &= ~0x10;
+  #ifdef Serial_Commands
+  idleAfter = powerDown(1) == POWER_WAKE_SERIAL ? IDLE_TIMEOUT_MS : PROBE_LISTEN_MS;
+  #else
+  powerDown(0);
+  idleAfter = PROBE_LISTEN_MS;
+  #endif
+  captureStart();
+  idleSince = schedNow();
+  schedAfter(readerSleep, idleAfter);
+}
+
+/********************************* IDLE WAIT **********************************\
+| Called at the end of the main loop. If there is nothing waiting for the     |
+| main loop it stops the CPU until the next interrupt, a wave, a serial byte  |
+| or the millisecond tick. The timers and the USART keep running              |
+\******************************************************************************/
+void idleWait (void) {
+  char busy = 0;
+  #ifdef Streaming_Decoder
+  unsigned char c;
+  #endif
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  cli();
+  #ifdef Streaming_Decoder
+  for (c = 0; c < CHANNELS; c++) {
+    busy |= channels[c].waveTail != channels[c].waveHead;
   }
+  #else
+  busy = captureTail != captureHead;
+  #endif
+  #ifdef Serial_Commands
+  busy |= rxTail != rxHead;
   #endif
+  if (!busy) {
+    sleep_enable();
+    sei();
+    sleep_cpu();
+    sleep_disable();
+  }
+  sei();
 }
+#endif
 
 /******************************* MAIN FUNCTION *******************************\
 | This is the main function, it initilized the variabls and then waits for    |
 | interrupt to fill the buffer before analizing the gathered data             |
 \*****************************************************************************/
 int main (void) {
-  int i = 0;
+  unsigned char c;
+  #ifndef Streaming_Decoder
+  unsigned char captureRead = 0; // which buffer is analized next
+  char captureAnalized = 0;      // it has been analized but not handed back
+  #endif
 
   //------------------------------------------
   // VARIABLE INITLILIZATION
   //------------------------------------------
 
-  // Load the list of valid ID tags
-  addNames(); 
-  
+  // Start the millisecond tick first, so readyClock counts all of main
+  schedInit();
+
   //==========> PIN INITILIZATION <==========//
   DDRD = 0x00; // 00000000 configure output on port D
   DDRB = 0x1E; // 00011100 configure output on port B
   
   //=========> SERVO INITILIZATION <=========//
+  #ifndef Input_Capture_Demod
   ICR1 = 10000;// TOP count for the PWM TIMER
   
   // Set on match, clear on TOP
   TCCR1A  = ((1 << COM1A1) | (1 << COM1A0));
   TCCR1B  = ((1 << CS11) | (1 << WGM13));
-  
-  // Move the servo to close Position
-  OCR1A = 10000 - SERVO_CLOSE;
-  {
-    unsigned long j;
-    for (j = 0; j < 500000; j++) {
-      asm volatile ("nop");
-    }
-  }
-  // Set servo to idle
-  OCR1A = 0;
+  #else
+  // Free running at 1us per tick, capture on the rising edge of DEMOD_OUT
+  // with the noise canceler on, the servo pulses come from compare match A
+  TCCR1A  = 0;
+  TCCR1B  = ((1 << ICNC1) | (1 << ICES1) | (1 << CS11));
+  #endif
+  sei ();       // enable global interrupts
   
   // USART INITILIZATION
   USART_Init();
+
+  // Move the servo to the close position, it goes idle after SERVO_MOVE_MS
+  // while the reader is already reading
+  doorClose();
+  schedAfter(tagsRemoved, CACHE_POLL_MS);
+  #ifdef Low_Power_Idle
+  powerInit();
+  idleSince = schedNow();
+  idleAfter = IDLE_TIMEOUT_MS;
+  schedAfter(readerSleep, IDLE_TIMEOUT_MS);
+  #endif
   
   //========> VARIABLE INITILIZATION <=======//
   count = 0;
-  begin = malloc (sizeof(char)*ARRAYSIZE);
-  iter = 0;
-  for (i = 0; i < ARRAYSIZE; i ++) {
-    begin[i] = 0;
+  decodeInit();
+  storeInit(); // index the whitelist tags kept in EEPROM
+  #ifdef EVENTS_ENABLED
+  eventInit(); // find where the event log was left
+  #endif
+  for (c = 0; c < CHANNELS; c++) {
+    decoderReset(&channels[c].reader);
+    voteReset(&channels[c].vote);
   }
+  #ifndef Streaming_Decoder
+  captureFill = 0;
+  captureWrite = begin;
+  captureEnd = begin + ARRAYSIZE;
+  #endif
   
   //=======> INTERRUPT INITILAIZATION <======//
-  sei ();       // enable global interrupts
+  #ifndef Input_Capture_Demod
   EICRA = 0x03; // configure interupt INT0
   EIMSK = 0x01; // enabe interrupt INT0
+  #else
+  TIMSK1 |= (1 << ICIE1); // enable the Timer1 input capture interrupt
+  #endif
+  #ifdef Second_Channel
+  PCMSK1 = (1 << PCINT8); // the second DEMOD_OUT, PC0
+  PCICR |= (1 << PCIE1);
+  #endif
+  #ifdef STATS_ENABLED
+  readyClock = schedClock();
+  #endif
   
   //------------------------------------------
   // MAIN LOOP
   //------------------------------------------
   while (1) {
-    sei(); //enable interrupts
-    
-    while (1) { // while the card is being read
-      if (iter >= ARRAYSIZE) { // if the buffer is full
-        cli(); // disable interrupts
-        break; // continue to analize the buffer
+    #ifdef Streaming_Decoder
+    // decode waves as they arrive, interrupts are never turned off so the
+    // cards keep being read while a frame is decoded and reported
+    decodeQueued(0);
+    #else
+    // wait for the interrupt to fill a buffer, it keeps capturing into the
+    // next buffer while this one is analized
+    if (captureTail != captureHead && !captureAnalized) {
+      PORTB &= ~0x10;
+      #ifdef Raw_Capture_Stream
+      // the raw stream sends the buffer while it is analized
+      rawBuffer (begin + captureRead * ARRAYSIZE);
+      #endif
+      
+      // the waves before it were thrown away, its first frame does not
+      // carry on from the last buffer. captureGap of a full buffer is only
+      // written by the interrupt again once it is handed back
+      if (captureGap[captureRead]) {
+        captureGap[captureRead] = 0;
+        decoderReset(&channels[0].reader);
       }
-    }  
+      //analize the oldest full buffer
+      STAT_STAGE(channels[0].reader.state == STREAM_READING ? STAT_DECODE : STAT_SEARCH);
+      analizeInput (begin + captureRead * ARRAYSIZE);
+      STAT_STAGE(STAT_IDLE);
+      #ifdef STATS_ENABLED
+      statsArrival();
+      #endif
+      captureAnalized = 1;
+    }
     
-    PORTB &= ~0x1C;
+    // hand the buffer back to the interrupt, every value in it will be
+    // written again before it is analized so it does not need to be cleared
+    #ifdef Raw_Capture_Stream
+    if (captureAnalized && !rawBusy) {
+    #else
+    if (captureAnalized) {
+    #endif
+      captureRead = captureRead + 1;
+      if (captureRead == CAPTURE_BUFFERS) {
+        captureRead = 0;
+      }
+      captureTail = captureTail + 1;
+      captureAnalized = 0;
+    }
+    #endif
     
-    //analize the array of input
-    analizeInput ();
+    #ifdef Raw_Capture_Stream
+    rawPoll();
+    #endif
     
-    //reset the saved values to prevent errors when reading another card
-    count = 0;
-    iter = 0;
-    for (i = 0; i < ARRAYSIZE; i ++) {
-      begin[i] = 0;
-    }
+    #ifdef Serial_Commands
+    serialPoll();
+    #endif
+    // start writing the next byte of a whitelist change if the EEPROM is free
+    storePump();
+    // run the door, leds and button
+    schedRun();
+    #ifdef Low_Power_Idle
+    idleWait();
+    #endif
   }
 }
@@ -0,0 +1,191 @@
+ /*****************************************************************************\ 
+ |         This program was written by Asher Glick aglick@tetrakai.com         | 
+ |             This program is currently under the GNU GPL licence             |
+ \*****************************************************************************/
+
+/*********************************** POWER ***********************************\
+| Puts the ATmega328P in power down between cards. Nothing runs while it is  |
+| asleep, not even Timer0, so it only wakes for a change on DEMOD_OUT (PB0,  |
+| PCINT0), a byte arriving on RXD (PD0, PCINT16) or the watchdog probe every |
+| POWER_PROBE_MS. main.c decides when to sleep and what to do on waking      |
+\*****************************************************************************/
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/power.h>
+#include <avr/sleep.h>
+#include <avr/wdt.h>
+#include <util/atomic.h>
+
+#include "power.h"
+#include "sched.h"
+
+#define POWER_PROBE_TICKS ((POWER_PROBE_MS + POWER_TICK_MS / 2) / POWER_TICK_MS)
+#if POWER_PROBE_TICKS < 1
+  #error "POWER_PROBE_MS has to be at least one watchdog tick, POWER_TICK_MS"
+#endif
+
+struct power power;
+volatile unsigned char powerWake; // POWER_WAKE_ reason, set by the interrupts
+volatile unsigned int powerTicks; // watchdog ticks slept through
+unsigned int powerWokeAt;         // schedNow() when the reader last woke
+unsigned int powerCountedAt;      // schedNow() when awakeMs was last added to
+char powerReading;                // no tag has been read since waking
+
+/****************************** WAKE INTERRUPTS *******************************\
+| Each one only says why the reader woke, powerDown turns them all off again.  |
+| The watchdog runs every POWER_TICK_MS and counts the time asleep, it only    |
+| wakes the reader for good after POWER_PROBE_MS                               |
+\******************************************************************************/
+ISR(PCINT0_vect) {
+  powerWake = POWER_WAKE_ACTIVITY;
+}
+
+ISR(PCINT2_vect) {
+  powerWake = POWER_WAKE_SERIAL;
+}
+
+ISR(WDT_vect) {
+  if (++powerTicks >= POWER_PROBE_TICKS) {
+    powerWake = POWER_WAKE_PROBE;
+  }
+}
+
+/********************************* POWER INIT *********************************\
+| Turns off the parts of the chip the reader never uses, the ADC, the analog  |
+| comparator, SPI and TWI, so they draw nothing awake or asleep               |
+\******************************************************************************/
+void powerInit (void) {
+  ADCSRA &= ~(1 << ADEN);
+  ACSR |= (1 << ACD);
+  power_adc_disable();
+  power_spi_disable();
+  power_twi_disable();
+  powerReset();
+}
+
+/********************************* POWER DOWN *********************************\
+| Sleeps in power down until DEMOD_OUT changes, the watchdog probe runs out   |
+| or, if serialWake is set, a byte starts arriving. That byte is lost, the    |
+| USART is stopped until the clock starts again. The time asleep is counted    |
+| in watchdog ticks, plus half a tick for a wake up part way through one,      |
+| and the millisecond tick is moved on by it so scheduled tasks still run      |
+| about on time.                                                               |
+| The capture interrupts and anything else that should not run asleep have   |
+| to be turned off first. Returns the POWER_WAKE_ reason                      |
+\******************************************************************************/
+unsigned char powerDown (char serialWake) {
+  unsigned int asleep;
+  unsigned char wake;
+  powerTally();
+  powerWake = POWER_WAKE_NONE;
+  powerTicks = 0;
+  PCMSK0 |= (1 << PCINT0);
+  PCICR |= (1 << PCIE0);
+  if (serialWake) {
+    PCMSK2 |= (1 << PCINT16);
+    PCICR |= (1 << PCIE2);
+  }
+  // the watchdog change has to be done within four clocks of setting WDCE
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    wdt_reset();
+    WDTCSR = (1 << WDCE) | (1 << WDE);
+    WDTCSR = (1 << WDIE); // the shortest period, POWER_TICK_MS
+  }
+
+  set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+  cli();
+  while (powerWake == POWER_WAKE_NONE) {
+    // sei() only takes effect after the next instruction, so an interrupt
+    // that comes now still wakes the sleep instead of being missed
+    sleep_enable();
+    sei();
+    sleep_cpu();
+    sleep_disable();
+    cli();
+  }
+  wake = powerWake;
+  sei();
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    MCUSR &= ~(1 << WDRF);
+    WDTCSR = (1 << WDCE) | (1 << WDE);
+    WDTCSR = 0;
+  }
+  PCICR &= ~((1 << PCIE0) | (1 << PCIE2));
+  PCMSK0 &= ~(1 << PCINT0);
+  PCMSK2 &= ~(1 << PCINT16);
+
+  asleep = powerTicks * POWER_TICK_MS;
+  if (wake != POWER_WAKE_PROBE) {
+    asleep += POWER_TICK_MS / 2;
+  }
+  schedSkip(asleep);
+  power.asleepMs += asleep;
+  power.wakes[wake]++;
+  powerWokeAt = schedNow();
+  powerCountedAt = powerWokeAt;
+  powerReading = 1;
+  return wake;
+}
+
+/********************************* POWER READ *********************************\
+| Called when a tag is reported, times the first one after each wake up       |
+\******************************************************************************/
+void powerRead (void) {
+  if (powerReading) {
+    power.readLast = schedNow() - powerWokeAt;
+    if (power.readLast > power.readMax) {
+      power.readMax = power.readLast;
+    }
+    powerReading = 0;
+  }
+}
+
+/******************************** POWER TALLY *********************************\
+| Adds the time since it was last called to awakeMs. The millisecond tick     |
+| wraps every 65.5 seconds, so it has to be called more often than that while |
+| the reader stays awake. powerAwake returns awakeMs with the time since      |
+\******************************************************************************/
+void powerTally (void) {
+  unsigned int now = schedNow();
+  power.awakeMs += (unsigned int)(now - powerCountedAt);
+  powerCountedAt = now;
+}
+
+unsigned long powerAwake (void) {
+  return power.awakeMs + (unsigned int)(schedNow() - powerCountedAt);
+}
+
+/******************************* POWER AVERAGE ********************************\
+| Returns the average current in microamps, from the time awake and asleep    |
+| and POWER_AWAKE_UA and POWER_ASLEEP_UA. The times are halved until they fit |
+| 16 bits so the multiply does not overflow                                   |
+\******************************************************************************/
+unsigned int powerAverage (void) {
+  unsigned long awake = powerAwake();
+  unsigned long total = awake + power.asleepMs;
+  while (total > 0xFFFF) {
+    awake >>= 1;
+    total >>= 1;
+  }
+  if (total == 0) {
+    return POWER_AWAKE_UA;
+  }
+  return POWER_ASLEEP_UA + awake * (POWER_AWAKE_UA - POWER_ASLEEP_UA) / total;
+}
+
+/******************************** POWER RESET *********************************\
+| Sets the counters back to 0                                                  |
+\******************************************************************************/
+void powerReset (void) {
+  unsigned char i;
+  for (i = 0; i < POWER_WAKES; i++) {
+    power.wakes[i] = 0;
+  }
+  power.asleepMs = 0;
+  power.awakeMs = 0;
+  power.readLast = 0;
+  power.readMax = 0;
+  powerCountedAt = schedNow();
+}
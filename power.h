@@ -0,0 +1,52 @@
+ /*****************************************************************************\ 
+ |         This program was written by Asher Glick aglick@tetrakai.com         | 
+ |             This program is currently under the GNU GPL licence             |
+ \*****************************************************************************/
+
+#ifndef POWER_H
+#define POWER_H
+
+/******************************* POWER SETTINGS *******************************\
+| How often the reader wakes up on its own to look for a card, and the supply |
+| current of the ATmega328P awake and asleep, used to work out the average.   |
+| The currents are the typical ones from the datasheet at 8MHz and 5V, they   |
+| are only the AVR and not the antenna driver or the demodulator             |
+\******************************************************************************/
+#define POWER_PROBE_MS 500 // how often the watchdog wakes the reader, counted
+                           // in POWER_TICK_MS ticks
+#define POWER_AWAKE_UA 5000 // microamps while the reader is awake
+#define POWER_ASLEEP_UA 7   // microamps in power down with the watchdog on
+
+#define POWER_TICK_MS 16   // the watchdog's shortest period, the time asleep
+                           // is counted in these
+
+#define POWER_WAKE_NONE     0 // still asleep
+#define POWER_WAKE_ACTIVITY 1 // DEMOD_OUT changed, a card may be in the field
+#define POWER_WAKE_PROBE    2 // the watchdog woke it to look for a card
+#define POWER_WAKE_SERIAL   3 // a byte started arriving on RXD
+#define POWER_WAKES 4
+
+/*********************************** POWER ************************************\
+| How much the reader has slept since it started or powerReset was called.    |
+| The time asleep is counted in watchdog ticks, which are only good to about   |
+| 10%, and a wake up part way through a tick counts as half of one             |
+\******************************************************************************/
+struct power {
+  unsigned long wakes[POWER_WAKES]; // times woken for each reason
+  unsigned long asleepMs;   // time spent in power down
+  unsigned long awakeMs;    // time spent awake, up to the last powerTally
+  unsigned int readLast;    // ms from waking to the first tag, for the last
+                            // wake that read one
+  unsigned int readMax;     // the longest readLast has been
+};
+extern struct power power;
+
+void powerInit (void);
+unsigned char powerDown (char serialWake);
+void powerRead (void);
+void powerTally (void);
+unsigned long powerAwake (void);
+unsigned int powerAverage (void);
+void powerReset (void);
+
+#endif
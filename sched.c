@@ -0,0 +1,157 @@
+ /*****************************************************************************\ 
+ |         This program was written by Asher Glick aglick@tetrakai.com         | 
+ |             This program is currently under the GNU GPL licence             |
+ \*****************************************************************************/
+
+/********************************* SCHEDULER *********************************\
+| Runs functions after a number of milliseconds without stopping the main     |
+| loop. Timer0 interrupts once a millisecond and only counts, the tasks that  |
+| are due are run by schedRun() from the main loop, so a task never runs in  |
+| the middle of another one or of decoding. A task that needs to keep running |
+| schedules itself again                                                      |
+\*****************************************************************************/
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+#include "sched.h"
+
+volatile unsigned int schedTick; // milliseconds since schedInit, wraps at 65536
+
+struct schedEntry {
+  void (*task)(void); // function to run, 0 if the entry is free
+  unsigned int due;   // schedTick to run it at
+};
+struct schedEntry schedTable[SCHED_TASKS];
+unsigned char schedFull; // times schedAfter found no free entry, stops at 255
+
+/******************************** TIMER0 TICK *********************************\
+| Runs once a millisecond                                                      |
+\******************************************************************************/
+ISR(TIMER0_COMPA_vect) {
+  schedTick++;
+}
+
+/********************************* SCHED INIT *********************************\
+| Starts Timer0 in clear on compare match mode so it interrupts once a        |
+| millisecond, and empties the task table                                      |
+\******************************************************************************/
+void schedInit (void) {
+  unsigned char i;
+  for (i = 0; i < SCHED_TASKS; i++) {
+    schedTable[i].task = 0;
+  }
+  TCCR0A = (1 << WGM01);
+  TCCR0B = (1 << CS01) | (1 << CS00);
+  OCR0A = SCHED_COUNTS - 1;
+  TIMSK0 |= (1 << OCIE0A);
+}
+
+/********************************* SCHED NOW **********************************\
+| Returns the millisecond tick, it wraps every 65.5 seconds so only compare   |
+| the difference between two ticks                                            |
+\******************************************************************************/
+unsigned int schedNow (void) {
+  unsigned int now;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    now = schedTick;
+  }
+  return now;
+}
+
+/******************************** SCHED CLOCK *********************************\
+| Returns the time in Timer0 counts, SCHED_PRESCALE clocks each, for timing    |
+| things that take less than a millisecond. It wraps about every half second  |
+| so only compare the difference between two clocks                           |
+\******************************************************************************/
+unsigned int schedClock (void) {
+  unsigned int tick;
+  unsigned char count;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    count = TCNT0;
+    tick = schedTick;
+    // the timer went back to 0 before count was read but its interrupt has
+    // not run yet, so that millisecond is not in schedTick
+    if ((TIFR0 & (1 << OCF0A)) && count < SCHED_COUNTS / 2) {
+      tick++;
+    }
+  }
+  return tick * SCHED_COUNTS + count;
+}
+
+/********************************* SCHED SKIP *********************************\
+| Moves the millisecond tick on by ms, for time Timer0 was stopped in sleep   |
+\******************************************************************************/
+void schedSkip (unsigned int ms) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    schedTick += ms;
+  }
+}
+
+/******************************** SCHED AFTER *********************************\
+| Runs task once, ms milliseconds from now. If task is already waiting it is  |
+| moved to the new time instead of being run twice. Returns 0 if the table is |
+| full and the task will not run, and counts it in schedFull for the S command |
+\******************************************************************************/
+char schedAfter (void (*task)(void), unsigned int ms) {
+  unsigned char i;
+  unsigned char free = SCHED_TASKS;
+  for (i = 0; i < SCHED_TASKS; i++) {
+    if (schedTable[i].task == task) {
+      free = i;
+      break;
+    }
+    if (schedTable[i].task == 0 && free == SCHED_TASKS) {
+      free = i;
+    }
+  }
+  if (free == SCHED_TASKS) {
+    if (schedFull < 255) {
+      schedFull++;
+    }
+    return 0;
+  }
+  schedTable[free].due = schedNow() + ms;
+  schedTable[free].task = task;
+  return 1;
+}
+
+/******************************** SCHED CANCEL ********************************\
+| Stops a task that is waiting from running                                    |
+\******************************************************************************/
+void schedCancel (void (*task)(void)) {
+  unsigned char i;
+  for (i = 0; i < SCHED_TASKS; i++) {
+    if (schedTable[i].task == task) {
+      schedTable[i].task = 0;
+    }
+  }
+}
+
+// Returns 1 if task is waiting to run
+char schedPending (void (*task)(void)) {
+  unsigned char i;
+  for (i = 0; i < SCHED_TASKS; i++) {
+    if (schedTable[i].task == task) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/********************************* SCHED RUN **********************************\
+| Called from the main loop, runs every task that is due. The entry is freed  |
+| before the task runs so the task can schedule itself again                  |
+\******************************************************************************/
+void schedRun (void) {
+  unsigned int now = schedNow();
+  unsigned char i;
+  for (i = 0; i < SCHED_TASKS; i++) {
+    void (*task)(void) = schedTable[i].task;
+    if (task != 0 && (int)(now - schedTable[i].due) >= 0) {
+      schedTable[i].task = 0;
+      task();
+    }
+  }
+}
@@ -0,0 +1,29 @@
+ /*****************************************************************************\ 
+ |         This program was written by Asher Glick aglick@tetrakai.com         | 
+ |             This program is currently under the GNU GPL licence             |
+ \*****************************************************************************/
+
+#ifndef SCHED_H
+#define SCHED_H
+
+#define SCHED_TASKS 10 // most tasks that can be waiting to run at once. There
+                       // are 8 different tasks, the rest is headroom
+
+#ifndef FOSC
+#define FOSC 8000000 // Clock Speed of the procesor
+#endif
+#define SCHED_PRESCALE 64 // Timer0 counts once every 64 clocks
+#define SCHED_COUNTS (FOSC / SCHED_PRESCALE / 1000) // Timer0 counts in 1ms
+
+extern unsigned char schedFull; // tasks lost because the table was full
+
+void schedInit (void);
+unsigned int schedNow (void);
+unsigned int schedClock (void);
+void schedSkip (unsigned int ms);
+char schedAfter (void (*task)(void), unsigned int ms);
+void schedCancel (void (*task)(void));
+char schedPending (void (*task)(void));
+void schedRun (void);
+
+#endif
@@ -0,0 +1,49 @@
+ /*****************************************************************************\ 
+ |         This program was written by Asher Glick aglick@tetrakai.com         | 
+ |             This program is currently under the GNU GPL licence             |
+ \*****************************************************************************/
+
+/*********************************** STATS ***********************************\
+| Counters for how the reader is doing in the field, read with the S serial  |
+| command. They are counted with STAT_COUNT and STAT_STAGE where each         |
+| thing happens, which compile to nothing without STATS_ENABLED              |
+\*****************************************************************************/
+
+#include "stats.h"
+#include "sched.h"
+
+#ifdef STATS_ENABLED
+struct stats stats;
+#endif
+
+#if defined(STATS_ENABLED) && !defined(HOST_BUILD)
+/******************************** STATS STAGE *********************************\
+| Adds the Timer0 counts since the last call to the stage the main loop was    |
+| in and starts timing the new one. It is only called when the stage changes,  |
+| not for every wave, so the timing costs little                               |
+\******************************************************************************/
+unsigned char statStage;     // STAT_ stage being timed
+unsigned int statSince;      // schedClock() when it started
+
+void statsStage (unsigned char stage) {
+  unsigned int now = schedClock();
+  if (statStage != STAT_IDLE) {
+    stats.stageTime[statStage] += (unsigned int)(now - statSince);
+  }
+  statStage = stage;
+  statSince = now;
+}
+#endif
+
+/******************************** STATS RESET *********************************\
+| Sets every counter back to 0                                                 |
+\******************************************************************************/
+void statsReset (void) {
+  #ifdef STATS_ENABLED
+  unsigned char * counter = (unsigned char *)&stats;
+  unsigned char i;
+  for (i = 0; i < sizeof(stats); i++) {
+    counter[i] = 0;
+  }
+  #endif
+}
@@ -0,0 +1,68 @@
+ /*****************************************************************************\ 
+ |         This program was written by Asher Glick aglick@tetrakai.com         | 
+ |             This program is currently under the GNU GPL licence             |
+ \*****************************************************************************/
+
+#ifndef STATS_H
+#define STATS_H
+
+/******************************* STATS SETTINGS *******************************\
+| Comment this out and every counter, and the timing around each stage, is    |
+| compiled out                                                                 |
+\******************************************************************************/
+#define STATS_ENABLED
+
+/********************************* STATS STAGES *******************************\
+| What the main loop is doing, each has its own time in stats.stageTime        |
+\******************************************************************************/
+#define STAT_IDLE   0 // anything else, not timed
+#define STAT_SEARCH 1 // decodeWave looking for a start tag
+#define STAT_DECODE 2 // decodeWave reading half bits and manchester code
+#define STAT_VOTE   3 // voting on a frame and checking the cache
+#define STAT_REPORT 4 // sending a tag, checking the whitelist and the door
+#define STAT_STAGES 5
+
+/*********************************** STATS ************************************\
+| How the reader has been doing since it started or the counters were reset.  |
+| Times are in Timer0 counts, 64 clocks each (see schedClock in sched.c)      |
+\******************************************************************************/
+struct stats {
+  unsigned long edges;         // INT0 or input capture interrupts
+  unsigned long waves;         // waves handed to the decoder
+  unsigned long overruns;      // waves (streaming) or capture buffers thrown
+                               // away because the main loop was behind
+  unsigned long startTags;     // start tags found
+  unsigned long noStartTag;    // capture buffers without a start tag
+  unsigned long badWaves;      // frames given up on a group of waves that is
+                               // not a manchester bit
+  unsigned long badManchester; // frames given up on a pair of bits that is not
+                               // manchester code
+  unsigned long shortFrames;   // frames that ended before all 45 bits were read
+  unsigned long frames;        // frames decoded
+  unsigned long badParity;     // frames that are not a known format or failed
+                               // its parity
+  unsigned long stageTime[STAT_STAGES]; // time spent in each STAT_ stage,
+                               // the STAT_IDLE one is left at 0
+  unsigned int presentLast;    // ms from a card's first start tag to its first
+                               // frame with good parity, for the last card
+  unsigned int presentMax;     // the longest presentLast has been
+};
+
+#ifdef STATS_ENABLED
+extern struct stats stats;
+#define STAT_COUNT(counter) (stats.counter++)
+#else
+#define STAT_COUNT(counter)
+#endif
+
+// the stages are timed with Timer0, which the host bench does not have
+#if defined(STATS_ENABLED) && !defined(HOST_BUILD)
+#define STAT_STAGE(stage) statsStage(stage)
+void statsStage (unsigned char stage);
+#else
+#define STAT_STAGE(stage)
+#endif
+
+void statsReset (void);
+
+#endif
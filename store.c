@@ -0,0 +1,289 @@
+ /*****************************************************************************\
+ |         This program was written by Asher Glick aglick@tetrakai.com         |
+ |             This program is currently under the GNU GPL licence             |
+ \*****************************************************************************/
+
+/*********************************** STORE ***********************************\
+| Credentials added over serial are kept in EEPROM so they survive a reset    |
+| without reflashing. Each slot is a credential packed like a decoded frame,  |
+| the four bits after the 44 bits of the tag mark if the slot is in use.      |
+| An index sorted on frame bits 28 to 43 is kept in SRAM so looking a tag up  |
+| only reads the EEPROM slots whose sort key already matches. For every       |
+| format in FORMATS those bits are the low 16 bits of the unique id, all of   |
+| it for a 26 bit card                                                        |
+|                                                                             |
+| Writing a byte of EEPROM takes 3.4ms, so changes are queued and storePump() |
+| starts one byte each time the EEPROM is ready instead of waiting for it.    |
+| The mark is written last so a slot that was only partly written when the   |
+| power went out is never read as a credential                                |
+\*****************************************************************************/
+
+#include <avr/eeprom.h>
+
+#include "events.h"
+#include "store.h"
+
+#define STORE_INDEX_OFFSET 28 // first frame bit of the sort key
+#define STORE_INDEX_LENGTH 16 // bits in the sort key
+
+unsigned char storeRecords[STORE_SLOTS][STORE_RECORD_BYTES] EEMEM;
+
+unsigned int storeSortKeys[STORE_SLOTS]; // sort key of each credential, sorted
+unsigned char storeSlots[STORE_SLOTS];   // EEPROM slot of each key in storeSortKeys
+unsigned char storeSize;               // number of credentials in the index
+unsigned char storeUsed[(STORE_SLOTS + 7) / 8]; // slots in use or being written
+
+/******************************** PENDING WRITE *******************************\
+| A change waiting to be written. An add writes the whole record, a remove    |
+| only writes the last byte with the mark                                      |
+\******************************************************************************/
+struct storeWrite {
+  unsigned char record[STORE_RECORD_BYTES]; // what the slot is changed to
+  unsigned char slot;                       // which slot is written
+  unsigned char next;                       // next byte of record to write
+};
+struct storeWrite storeQueue[STORE_PENDING];
+unsigned char storeQueueFirst; // the write storePump is working on
+unsigned char storeQueued;     // number of writes waiting
+
+/****************************** STORE HELPERS *********************************\
+| Slot bitmap, the sort key of a frame and comparing a frame to a record      |
+\******************************************************************************/
+static char slotUsed (unsigned char slot) {
+  return storeUsed[slot >> 3] & (1 << (slot & 0x07));
+}
+
+static void setSlotUsed (unsigned char slot, char used) {
+  if (used) {
+    storeUsed[slot >> 3] |= 1 << (slot & 0x07);
+  }
+  else {
+    storeUsed[slot >> 3] &= ~(1 << (slot & 0x07));
+  }
+}
+
+static unsigned int frameSortKey (const unsigned char frame[FRAME_BYTES]) {
+  return getFrameField(frame, STORE_INDEX_OFFSET, STORE_INDEX_LENGTH);
+}
+
+static char sameKey (const unsigned char a[STORE_RECORD_BYTES], const unsigned char b[STORE_RECORD_BYTES]) {
+  unsigned char i;
+  for (i = 0; i < STORE_RECORD_BYTES - 1; i++) {
+    if (a[i] != b[i]) {
+      return 0;
+    }
+  }
+  return ((a[i] ^ b[i]) & STORE_KEY_MASK) == 0;
+}
+
+/********************************* INDEX FIND *********************************\
+| Returns the position in the index of the credential that matches frame, or |
+| STORE_SLOTS if it is not stored. The binary search finds the first entry    |
+| with the same sort key, then only those entries are read from EEPROM        |
+\******************************************************************************/
+static unsigned char indexFind (const unsigned char frame[FRAME_BYTES]) {
+  unsigned int key = frameSortKey(frame);
+  unsigned char low = 0;
+  unsigned char high = storeSize;
+  unsigned char record[STORE_RECORD_BYTES];
+  while (low < high) {
+    unsigned char middle = (low + high) >> 1;
+    if (storeSortKeys[middle] < key) {
+      low = middle + 1;
+    }
+    else {
+      high = middle;
+    }
+  }
+  for (; low < storeSize && storeSortKeys[low] == key; low++) {
+    eventPause();
+    eeprom_read_block(record, storeRecords[storeSlots[low]], STORE_RECORD_BYTES);
+    eventResume();
+    if (sameKey(record, frame)) {
+      return low;
+    }
+  }
+  return STORE_SLOTS;
+}
+
+/******************************** INDEX INSERT ********************************\
+| Adds a slot to the index, keeping it sorted by sort key                      |
+\******************************************************************************/
+static void indexInsert (unsigned int key, unsigned char slot) {
+  unsigned char i = storeSize;
+  while (i > 0 && storeSortKeys[i - 1] > key) {
+    storeSortKeys[i] = storeSortKeys[i - 1];
+    storeSlots[i] = storeSlots[i - 1];
+    i--;
+  }
+  storeSortKeys[i] = key;
+  storeSlots[i] = slot;
+  storeSize++;
+}
+
+static void indexDelete (unsigned char position) {
+  storeSize--;
+  for (; position < storeSize; position++) {
+    storeSortKeys[position] = storeSortKeys[position + 1];
+    storeSlots[position] = storeSlots[position + 1];
+  }
+}
+
+/********************************* STORE INIT *********************************\
+| Reads every slot in EEPROM once and builds the index of the ones in use     |
+\******************************************************************************/
+void storeInit (void) {
+  unsigned char slot;
+  unsigned char record[STORE_RECORD_BYTES];
+  storeSize = 0;
+  storeQueued = 0;
+  storeQueueFirst = 0;
+  for (slot = 0; slot < STORE_SLOTS; slot++) {
+    eventPause();
+    eeprom_read_block(record, storeRecords[slot], STORE_RECORD_BYTES);
+    eventResume();
+    if ((record[STORE_RECORD_BYTES - 1] & STORE_MARK_MASK) == STORE_VALID) {
+      setSlotUsed(slot, 1);
+      indexInsert(frameSortKey(record), slot);
+    }
+    else {
+      setSlotUsed(slot, 0);
+    }
+  }
+}
+
+/******************************** STORE SEARCH ********************************\
+| Returns 1 if the credential in frame is stored in EEPROM and 0 if not       |
+\******************************************************************************/
+char storeSearch (const unsigned char frame[FRAME_BYTES]) {
+  return indexFind(frame) != STORE_SLOTS;
+}
+
+/******************************** QUEUE WRITE *********************************\
+| Returns the next free pending write, the caller fills it in. storeAdd and   |
+| storeRemove check there is room first                                        |
+\******************************************************************************/
+static struct storeWrite * queueWrite (void) {
+  unsigned char i = storeQueueFirst + storeQueued;
+  if (i >= STORE_PENDING) {
+    i -= STORE_PENDING;
+  }
+  storeQueued++;
+  return &storeQueue[i];
+}
+
+// Returns 1 if an add of the same credential is waiting to be written
+static char addPending (const unsigned char frame[FRAME_BYTES]) {
+  unsigned char i;
+  unsigned char position = storeQueueFirst;
+  for (i = 0; i < storeQueued; i++) {
+    struct storeWrite * write = &storeQueue[position];
+    // a remove only fills in the last byte of its record, so only adds are compared
+    if ((write->record[STORE_RECORD_BYTES - 1] & STORE_MARK_MASK) == STORE_VALID && sameKey(write->record, frame)) {
+      return 1;
+    }
+    position = position + 1 == STORE_PENDING ? 0 : position + 1;
+  }
+  return 0;
+}
+
+/********************************* STORE ADD **********************************\
+| Queues a credential to be written to a free slot. It can be found by        |
+| storeSearch once the last byte has been started by storePump                |
+\******************************************************************************/
+char storeAdd (const unsigned char frame[FRAME_BYTES]) {
+  unsigned char slot;
+  unsigned char i;
+  struct storeWrite * write;
+  if (indexFind(frame) != STORE_SLOTS || addPending(frame)) {
+    return STORE_EXISTS;
+  }
+  if (storeQueued == STORE_PENDING) {
+    return STORE_BUSY;
+  }
+  for (slot = 0; slot < STORE_SLOTS && slotUsed(slot); slot++);
+  if (slot == STORE_SLOTS) {
+    return STORE_FULL;
+  }
+  setSlotUsed(slot, 1);
+  write = queueWrite();
+  for (i = 0; i < STORE_RECORD_BYTES; i++) {
+    write->record[i] = frame[i];
+  }
+  write->record[STORE_RECORD_BYTES - 1] = (frame[STORE_RECORD_BYTES - 1] & STORE_KEY_MASK) | STORE_VALID;
+  write->slot = slot;
+  write->next = 0;
+  return STORE_OK;
+}
+
+/******************************** STORE REMOVE ********************************\
+| Takes a credential out of the index right away and queues the write that   |
+| marks its slot removed. The slot can be reused straight away, its new      |
+| record is queued after the remove so it is written after it                 |
+\******************************************************************************/
+char storeRemove (const unsigned char frame[FRAME_BYTES]) {
+  unsigned char position;
+  unsigned char slot;
+  struct storeWrite * write;
+  if (storeQueued == STORE_PENDING || addPending(frame)) {
+    return STORE_BUSY;
+  }
+  position = indexFind(frame);
+  if (position == STORE_SLOTS) {
+    return STORE_NOT_FOUND;
+  }
+  slot = storeSlots[position];
+  indexDelete(position);
+  setSlotUsed(slot, 0);
+  write = queueWrite();
+  write->record[STORE_RECORD_BYTES - 1] = (frame[STORE_RECORD_BYTES - 1] & STORE_KEY_MASK) | STORE_REMOVED;
+  write->slot = slot;
+  write->next = STORE_RECORD_BYTES - 1;
+  return STORE_OK;
+}
+
+/********************************* STORE PUMP *********************************\
+| Called from the main loop. If the EEPROM is not busy it starts writing the  |
+| next byte of the oldest pending change and returns without waiting for it   |
+\******************************************************************************/
+void storePump (void) {
+  struct storeWrite * write;
+  if (storeQueued == 0 || !eeprom_is_ready()) {
+    return;
+  }
+  write = &storeQueue[storeQueueFirst];
+  eventPause();
+  eeprom_update_byte(&storeRecords[write->slot][write->next], write->record[write->next]);
+  eventResume();
+  write->next++;
+  if (write->next == STORE_RECORD_BYTES) {
+    if ((write->record[STORE_RECORD_BYTES - 1] & STORE_MARK_MASK) == STORE_VALID) {
+      indexInsert(frameSortKey(write->record), write->slot);
+    }
+    storeQueueFirst = storeQueueFirst + 1 == STORE_PENDING ? 0 : storeQueueFirst + 1;
+    storeQueued--;
+  }
+}
+
+// Returns 1 if no change is waiting to be written and the EEPROM is not busy
+char storeIdle (void) {
+  return storeQueued == 0 && eeprom_is_ready();
+}
+
+/********************************* STORE COUNT ********************************\
+| The number of credentials that can be found by storeSearch                   |
+\******************************************************************************/
+unsigned char storeCount (void) {
+  return storeSize;
+}
+
+/********************************* STORE READ *********************************\
+| Reads the credential at position in the index (0 to storeCount()-1), sorted |
+| by frame bits 28 to 43, into frame                                           |
+\******************************************************************************/
+void storeRead (unsigned char position, unsigned char frame[FRAME_BYTES]) {
+  eventPause();
+  eeprom_read_block(frame, storeRecords[storeSlots[position]], STORE_RECORD_BYTES);
+  eventResume();
+  frame[STORE_RECORD_BYTES - 1] &= STORE_KEY_MASK;
+}
@@ -0,0 +1,41 @@
+ /*****************************************************************************\ 
+ |         This program was written by Asher Glick aglick@tetrakai.com         | 
+ |             This program is currently under the GNU GPL licence             |
+ \*****************************************************************************/
+
+#ifndef STORE_H
+#define STORE_H
+
+#include "decode.h"
+
+/******************************* STORE SETTINGS *******************************\
+| How many credentials the EEPROM holds and how many changes can be waiting   |
+| to be written. Each slot takes 6 bytes of EEPROM and 3 bytes of SRAM         |
+\******************************************************************************/
+#define STORE_SLOTS 64     // credentials kept in EEPROM (at most 255)
+#define STORE_PENDING 4    // adds and removes waiting to be written
+
+// these settings are used internally by the store
+#define STORE_RECORD_BYTES FRAME_BYTES // a credential packed like a frame
+#define STORE_KEY_MASK  0xF0 // bits of the last byte that are the credential
+#define STORE_MARK_MASK 0x0F // bits of the last byte that mark the slot
+#define STORE_ERASED    0x0F // mark of a slot that was never written
+#define STORE_VALID     0x0A // mark of a slot that holds a credential
+#define STORE_REMOVED   0x00 // mark of a slot whose credential was removed
+
+#define STORE_OK        0  // the change was queued
+#define STORE_FULL      1  // there is no free slot
+#define STORE_BUSY      2  // too many changes are waiting to be written
+#define STORE_EXISTS    3  // the credential is already stored
+#define STORE_NOT_FOUND 4  // the credential is not stored
+
+void storeInit (void);
+char storeSearch (const unsigned char frame[FRAME_BYTES]);
+char storeAdd (const unsigned char frame[FRAME_BYTES]);
+char storeRemove (const unsigned char frame[FRAME_BYTES]);
+void storePump (void);
+char storeIdle (void);
+unsigned char storeCount (void);
+void storeRead (unsigned char position, unsigned char frame[FRAME_BYTES]);
+
+#endif
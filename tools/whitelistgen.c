@@ -0,0 +1,242 @@
+ /*****************************************************************************\
+ |         This program was written by Asher Glick aglick@tetrakai.com         |
+ |             This program is currently under the GNU GPL licence             |
+ \*****************************************************************************/
+
+/******************************* WHITELIST GEN ********************************\
+| Turns a CSV of whole credentials into the sorted flash table searchTag      |
+| looks tags up in. Run by make when the CSV changes, see Doc/whitelist.md   |
+|                                                                             |
+| usage: whitelistgen whitelist.csv whitelist_table.h                          |
+|                                                                             |
+| Each line of the CSV is                                                      |
+|   manufacturer id, site code, unique id[, format]                            |
+| in decimal, or in hex starting with 0x. format is one of the names in       |
+| FORMATS in decode.h, H10301 if it is left out. Blank lines, lines starting  |
+| with '#' and one header line before the first credential, starting with     |
+| 'manufacturer', are skipped. Any other line is an error                     |
+\*****************************************************************************/
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "decode.h"
+
+#define KEY_BYTES 6 // a credential packed the same way as a decoded frame
+#define HEADER "manufacturer" // the first field of the header line
+
+/********************************** FORMATS ***********************************\
+| How many bits each field has in each card format, from FORMATS. The three   |
+| fields are the first 44 bits of a frame, one after the other               |
+\******************************************************************************/
+struct format {
+  const char * name;
+  int manufacturer;
+  int site;
+  int unique;
+};
+
+const struct format formats[] = {
+  #define FORMAT(name, bits, siteOffset, siteLength, uniqueOffset, uniqueLength) \
+  {#name, FORMAT_START(bits) + siteOffset, siteLength, uniqueLength},
+  FORMATS
+  #undef FORMAT
+};
+
+struct credential {
+  unsigned char key[KEY_BYTES];
+  int line; // line of the CSV it came from, for duplicate warnings
+};
+
+/******************************** PARSE FIELD *********************************\
+| Reads one number from a CSV line and moves text past it and its comma.      |
+| Returns 0 if there is no number or it is too big for an unsigned long       |
+\******************************************************************************/
+int parseField (char ** text, unsigned long * value) {
+  char * end;
+  while (isspace((unsigned char)**text)) {
+    (*text)++;
+  }
+  if (!isdigit((unsigned char)**text)) {
+    return 0;
+  }
+  errno = 0;
+  *value = strtoul(*text, &end, 0);
+  if (errno != 0) {
+    return 0;
+  }
+  while (isspace((unsigned char)*end)) {
+    end++;
+  }
+  if (*end == ',') {
+    end++;
+  }
+  *text = end;
+  return 1;
+}
+
+/******************************** PARSE FORMAT ********************************\
+| Reads the format name at the end of a CSV line, if there is one. Returns    |
+| the format, or NULL if the name is not one of FORMATS                       |
+\******************************************************************************/
+const struct format * parseFormat (char ** text) {
+  char * end;
+  size_t i;
+  size_t length;
+  while (isspace((unsigned char)**text)) {
+    (*text)++;
+  }
+  if (**text == '\0') {
+    return &formats[0];
+  }
+  for (end = *text; isalnum((unsigned char)*end); end++);
+  length = end - *text;
+  for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+    if (strlen(formats[i].name) == length && strncasecmp(formats[i].name, *text, length) == 0) {
+      while (isspace((unsigned char)*end)) {
+        end++;
+      }
+      *text = end;
+      return &formats[i];
+    }
+  }
+  return NULL;
+}
+
+/********************************* PACK KEY ***********************************\
+| Packs a credential into the first 44 bits of key, high bit first, the same  |
+| way decodeWave packs a frame. The last four bits are left 0                 |
+\******************************************************************************/
+void packKey (const struct format * format, unsigned long manufacturer, unsigned long site, unsigned long unique, unsigned char key[KEY_BYTES]) {
+  unsigned long long value;
+  int i;
+  value = manufacturer;
+  value = (value << format->site) | site;
+  value = (value << format->unique) | unique;
+  value <<= KEY_BYTES * 8 - (format->manufacturer + format->site + format->unique);
+  for (i = KEY_BYTES - 1; i >= 0; i--) {
+    key[i] = value & 0xFF;
+    value >>= 8;
+  }
+}
+
+int compareCredentials (const void * a, const void * b) {
+  return memcmp(((const struct credential *)a)->key, ((const struct credential *)b)->key, KEY_BYTES);
+}
+
+int main (int argc, char ** argv) {
+  struct credential * credentials = NULL;
+  int count = 0;
+  int size = 0;
+  int unique = 0;
+  int lineNumber = 0;
+  int header = 0;
+  char line[256];
+  FILE * input;
+  FILE * output;
+  int i;
+  int j;
+
+  if (argc != 3) {
+    fprintf(stderr, "usage: %s whitelist.csv whitelist_table.h\n", argv[0]);
+    return 2;
+  }
+  input = fopen(argv[1], "r");
+  if (input == NULL) {
+    perror(argv[1]);
+    return 1;
+  }
+
+  while (fgets(line, sizeof(line), input)) {
+    unsigned long manufacturer, site, id;
+    const struct format * format;
+    char * text = line;
+    lineNumber++;
+    while (isspace((unsigned char)*text)) {
+      text++;
+    }
+    if (*text == '\0' || *text == '#') {
+      continue;
+    }
+    if (count == 0 && !header && strncasecmp(text, HEADER, strlen(HEADER)) == 0) {
+      header = 1;
+      continue;
+    }
+    if (!parseField(&text, &manufacturer) ||
+        !parseField(&text, &site) ||
+        !parseField(&text, &id)) {
+      fprintf(stderr, "%s:%d: expected 'manufacturer id, site code, unique id[, format]'\n",
+              argv[1], lineNumber);
+      fclose(input);
+      return 1;
+    }
+    format = parseFormat(&text);
+    if (format == NULL || *text != '\0') {
+      fprintf(stderr, "%s:%d: the format has to be one of", argv[1], lineNumber);
+      for (i = 0; i < (int)(sizeof(formats) / sizeof(formats[0])); i++) {
+        fprintf(stderr, " %s", formats[i].name);
+      }
+      fprintf(stderr, "\n");
+      fclose(input);
+      return 1;
+    }
+    if ((manufacturer >> format->manufacturer) != 0 || (site >> format->site) != 0 ||
+        (id >> format->unique) != 0) {
+      fprintf(stderr, "%s:%d: a %s credential has to fit in %d, %d and %d bits\n",
+              argv[1], lineNumber, format->name, format->manufacturer, format->site, format->unique);
+      fclose(input);
+      return 1;
+    }
+    if (count == size) {
+      size = size ? size * 2 : 64;
+      credentials = realloc(credentials, size * sizeof(struct credential));
+      if (credentials == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+      }
+    }
+    packKey(format, manufacturer, site, id, credentials[count].key);
+    credentials[count].line = lineNumber;
+    count++;
+  }
+  fclose(input);
+
+  // searchTag does a binary search, so the table has to be sorted
+  qsort(credentials, count, sizeof(struct credential), compareCredentials);
+  for (i = 0; i < count; i++) {
+    if (unique > 0 && compareCredentials(&credentials[unique - 1], &credentials[i]) == 0) {
+      fprintf(stderr, "%s:%d: warning: duplicate of line %d, skipped\n",
+              argv[1], credentials[i].line, credentials[unique - 1].line);
+      continue;
+    }
+    credentials[unique++] = credentials[i];
+  }
+
+  output = fopen(argv[2], "w");
+  if (output == NULL) {
+    perror(argv[2]);
+    return 1;
+  }
+  fprintf(output, "// Generated from %s by tools/whitelistgen, do not edit\n\n", argv[1]);
+  fprintf(output, "#define WHITELIST_SIZE %d\n\n", unique);
+  // an empty array is not allowed, an empty list still has one unused entry
+  fprintf(output, "const unsigned char whitelist[%d][WHITELIST_KEY_BYTES] PROGMEM = {\n", unique ? unique : 1);
+  for (i = 0; i < unique; i++) {
+    fprintf(output, "  {");
+    for (j = 0; j < KEY_BYTES; j++) {
+      fprintf(output, "0x%02X%s", credentials[i].key[j], j < KEY_BYTES - 1 ? ", " : "");
+    }
+    fprintf(output, "}%s\n", i < unique - 1 ? "," : "");
+  }
+  if (unique == 0) {
+    fprintf(output, "  {0}\n");
+  }
+  fprintf(output, "};\n");
+  fclose(output);
+  free(credentials);
+  printf("%s: %d credentials, %d bytes of flash\n", argv[2], unique, unique * KEY_BYTES);
+  return 0;
+}
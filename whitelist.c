@@ -0,0 +1,58 @@
+ /*****************************************************************************\ 
+ |         This program was written by Asher Glick aglick@tetrakai.com         | 
+ |             This program is currently under the GNU GPL licence             |
+ \*****************************************************************************/
+
+/********************************* WHITELIST *********************************\
+| The list of tags that open the door. It is generated from whitelist.csv by  |
+| tools/whitelistgen when the firmware is built, and kept sorted in flash so  |
+| it does not use any SRAM no matter how many tags are on it. Tags added at  |
+| run time are kept in EEPROM by store.c                                     |
+\*****************************************************************************/
+
+#include <string.h>
+
+#include "hal.h"
+#include "store.h"
+#include "whitelist.h"
+#include "whitelist_table.h"
+
+/****************************** COMPARE KEY *******************************\
+| Compares a decoded frame to a credential in flash the way memcmp does.   |
+| Only the 44 bits of the tag are compared, not the parody bit after them  |
+\**************************************************************************/
+int compareKey (const unsigned char frame[FRAME_BYTES], const unsigned char * key) {
+  int result = memcmp_P(frame, key, WHITELIST_KEY_BYTES - 1);
+  if (result == 0) {
+    result = (int)(frame[WHITELIST_KEY_BYTES - 1] & WHITELIST_LAST_MASK)
+           - (int)pgm_read_byte(&key[WHITELIST_KEY_BYTES - 1]);
+  }
+  return result;
+}
+
+/********************************* Search Tag *********************************\
+| This function searches for a tag in the list of tags stored in the flash     |
+| memory, if the tag is found then the function returns 1 (true) if the tag    |
+| is not found then the function returns 0 (false). The whole tag has to       |
+| match, not just the unique id. The list is sorted so this is a binary        |
+| search, a list of 4096 tags takes 12 compares. Tags that are not in flash    |
+| are looked for in the credentials added over serial                          |
+\******************************************************************************/
+int searchTag (const unsigned char frame[FRAME_BYTES]) {
+  unsigned int low = 0;
+  unsigned int high = WHITELIST_SIZE; // one past the last tag that could match
+  while (low < high) {
+    unsigned int middle = low + ((high - low) >> 1);
+    int result = compareKey(frame, whitelist[middle]);
+    if (result == 0) {
+      return 1;
+    }
+    if (result < 0) {
+      high = middle;
+    }
+    else {
+      low = middle + 1;
+    }
+  }
+  return storeSearch(frame);
+}
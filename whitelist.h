@@ -0,0 +1,16 @@
+ /*****************************************************************************\ 
+ |         This program was written by Asher Glick aglick@tetrakai.com         | 
+ |             This program is currently under the GNU GPL licence             |
+ \*****************************************************************************/
+
+#ifndef WHITELIST_H
+#define WHITELIST_H
+
+#include "decode.h"
+
+#define WHITELIST_KEY_BYTES FRAME_BYTES // a credential is kept as a packed frame
+#define WHITELIST_LAST_MASK 0xF0        // bits of the last byte in the key
+
+int searchTag (const unsigned char frame[FRAME_BYTES]);
+
+#endif